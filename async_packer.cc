@@ -0,0 +1,141 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "async_packer.hh"
+#include <utility>
+
+async_packer::async_packer(
+    rect_packer& packer, bool allow_rotation, std::chrono::microseconds linger
+): packer(packer), allow_rotation(allow_rotation), linger(linger),
+   stopping(false), submitted(0), completed(0), batches(0)
+{
+    worker = std::thread([this](){ run(); });
+}
+
+async_packer::~async_packer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake_worker.notify_one();
+    worker.join();
+}
+
+std::future<rect_packer::rect> async_packer::pack_async(int w, int h)
+{
+    request req;
+    req.r.w = w;
+    req.r.h = h;
+    std::future<rect_packer::rect> result = req.promise.get_future();
+    push(std::move(req));
+    return result;
+}
+
+void async_packer::pack_async(int w, int h, callback done)
+{
+    request req;
+    req.r.w = w;
+    req.r.h = h;
+    req.done = std::move(done);
+    push(std::move(req));
+}
+
+void async_packer::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    std::uint64_t target = submitted;
+    batch_done.wait(lock, [&](){ return completed >= target; });
+}
+
+std::uint64_t async_packer::get_batch_count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return batches;
+}
+
+std::uint64_t async_packer::get_request_count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return completed;
+}
+
+void async_packer::push(request&& req)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(req));
+        submitted++;
+    }
+    wake_worker.notify_one();
+}
+
+void async_packer::run()
+{
+    std::vector<request> batch;
+    std::vector<rect_packer::rect> rects;
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;)
+    {
+        wake_worker.wait(lock, [&](){ return stopping || !queue.empty(); });
+        if(queue.empty()) break;
+
+        if(linger.count() > 0 && !stopping)
+        {
+            wake_worker.wait_for(lock, linger, [&](){ return stopping; });
+        }
+
+        // Everything queued so far becomes one batch, and new requests can
+        // queue up while it's being packed.
+        batch.swap(queue);
+        lock.unlock();
+
+        rects.clear();
+        for(request& req: batch) rects.push_back(req.r);
+        packer.pack(rects.data(), rects.size(), allow_rotation);
+
+        // A callback that throws must not keep the rest of the batch from
+        // being delivered, or end the worker and leave flush() waiting.
+        for(size_t i = 0; i < batch.size(); ++i)
+        {
+            if(!batch[i].done)
+            {
+                batch[i].promise.set_value(rects[i]);
+                continue;
+            }
+            try
+            {
+                batch[i].done(rects[i]);
+            }
+            catch(...)
+            {
+            }
+        }
+
+        lock.lock();
+        completed += batch.size();
+        batches++;
+        batch.clear();
+        batch_done.notify_all();
+    }
+}
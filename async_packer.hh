@@ -0,0 +1,103 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_ASYNC_PACKER_HH
+#define RECT_PACKER_ASYNC_PACKER_HH
+#include "rect_packer.hh"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Queues pack requests from any number of threads and packs them on a worker
+// thread of its own. Everything that has queued up while the worker was busy
+// is packed as one batch with rect_packer::pack(rect*, count), so the callers
+// don't wait for each other and get the better results of batch packing.
+//
+// The rect_packer must not be used by anything else while the async_packer
+// exists.
+class async_packer
+{
+public:
+    typedef std::function<void(const rect_packer::rect&)> callback;
+
+    // With a non-zero linger, the worker waits that long after the first
+    // request of a batch for more requests to arrive.
+    async_packer(
+        rect_packer& packer,
+        bool allow_rotation = false,
+        std::chrono::microseconds linger = std::chrono::microseconds(0)
+    );
+    // Packs the remaining requests before returning.
+    ~async_packer();
+
+    async_packer(const async_packer&) = delete;
+    async_packer& operator=(const async_packer&) = delete;
+
+    // The result has packed, x, y and rotated set like the batch pack()
+    // sets them.
+    std::future<rect_packer::rect> pack_async(int w, int h);
+
+    // The callback is called on the worker thread once the rect is packed.
+    // Exceptions thrown by it are caught and ignored.
+    void pack_async(int w, int h, callback done);
+
+    // Blocks until all requests made before the call have been packed.
+    void flush();
+
+    // Number of batches packed and requests in them so far.
+    std::uint64_t get_batch_count() const;
+    std::uint64_t get_request_count() const;
+
+private:
+    struct request
+    {
+        rect_packer::rect r;
+        std::promise<rect_packer::rect> promise;
+        callback done;
+    };
+
+    void push(request&& req);
+    void run();
+
+    rect_packer& packer;
+    bool allow_rotation;
+    std::chrono::microseconds linger;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake_worker;
+    std::condition_variable batch_done;
+    std::vector<request> queue;
+    bool stopping;
+    std::uint64_t submitted;
+    std::uint64_t completed;
+    std::uint64_t batches;
+
+    std::thread worker;
+};
+
+#endif
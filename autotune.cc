@@ -0,0 +1,318 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Offline cell size tuner. Sweeps canvas areas and mean rect sizes, times
+// filling a canvas with a batch of rects with each candidate cell size and
+// writes the fastest ones as the constexpr table in cell_size_table.hh. Run
+// it on the target hardware and rebuild to retune rect_packer's automatic
+// cell size:
+//
+//   patm-autotune -o cell_size_table.hh
+#include "rect_packer.hh"
+#include "rect_sets.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock tune_clock;
+
+// These define the table layout and must match what rect_packer.cc expects
+// of cell_size_table.hh.
+const int table_rows = 41;
+const int table_cols = 12;
+const int default_col = 3;
+
+const int candidates[] = {
+    2, 3, 4, 5, 6, 8, 10, 12, 16, 20, 24, 32, 40, 48, 64, 96, 128
+};
+
+struct tune_options
+{
+    int min_row = 10, max_row = 22;
+    int min_col = 1, max_col = 7;
+    // Minimum time spent on each candidate, in seconds.
+    double time = 0.05;
+    // Largest canvas size to mean rect size ratio to measure.
+    double max_ratio = 96;
+    unsigned seed = 0;
+};
+
+// Glyph-like rects with a mean size of 'size', enough to fill 95% of the
+// canvas. Like in an atlas, the packer goes from empty to nearly full.
+std::vector<rect_packer::rect> generate_rects(
+    int canvas, double size, unsigned seed
+){
+    glyph_generator gen(
+        {float(size), float(size/4), float(size), float(size/4), 100, 20},
+        seed
+    );
+    std::vector<rect_packer::rect> rects;
+    std::uint64_t area = 0;
+    std::uint64_t target = canvas * (std::uint64_t)canvas * 19 / 20;
+    while(area < target)
+    {
+        for(const rect_packer::rect& r: gen.next_group())
+        {
+            if(area >= target) break;
+            rects.push_back(r);
+            area += r.w * (std::uint64_t)r.h;
+        }
+    }
+    return rects;
+}
+
+// Seconds per rect.
+double time_cell_size(
+    int canvas, double size, int cell_size, const tune_options& opt
+){
+    double total = 0;
+    std::uint64_t count = 0;
+    for(unsigned trial = 0; total < opt.time; ++trial)
+    {
+        std::vector<rect_packer::rect> rects = generate_rects(
+            canvas, size, opt.seed + trial
+        );
+        rect_packer packer(canvas, canvas, false);
+        packer.set_cell_size(cell_size);
+        tune_clock::time_point start = tune_clock::now();
+        packer.pack(rects.data(), rects.size(), false);
+        total += std::chrono::duration<double>(
+            tune_clock::now() - start
+        ).count();
+        count += rects.size();
+    }
+    return count ? total / count : 0;
+}
+
+// Row i covers canvas areas in [2^i, 2^(i+1)) and column j mean rect sizes in
+// [2^j, 2^(j+1)). Each is measured at the geometric middle of its range.
+int tune_entry(int row, int col, const tune_options& opt)
+{
+    int canvas = std::lround(std::pow(2.0, (row + 0.5) / 2));
+    double size = std::pow(2.0, col + 0.5);
+
+    int best = 0;
+    double best_time = 0;
+    for(int cell_size: candidates)
+    {
+        if(cell_size > canvas) break;
+        // Cells far smaller than the rects are always slow, and timing them
+        // first would let noise stop the search before it gets anywhere.
+        if(cell_size * 8 < size) continue;
+        double t = time_cell_size(canvas, size, cell_size, opt);
+        if(best == 0 || t < best_time)
+        {
+            best = cell_size;
+            best_time = t;
+        }
+        // Past the best size, the time only keeps growing.
+        else if(t > best_time * 2) break;
+    }
+    fprintf(
+        stderr, "area 2^%d (%dx%d), size %.1f: %d (%.3g us/rect)\n",
+        row, canvas, canvas, size, best, best_time * 1e6
+    );
+    return best;
+}
+
+// Single timings are noisy, so each measured entry is replaced by the median
+// of itself and its nearest measured neighbours in the same column. Rows
+// that weren't measured take the nearest smoothed row of their column.
+// Columns that weren't measured at all are halved from the next larger size,
+// or repeat the next smaller one.
+void fill_table(int table[table_rows][table_cols])
+{
+    for(int col = 0; col < table_cols; ++col)
+    {
+        std::vector<int> rows;
+        for(int row = 0; row < table_rows; ++row)
+            if(table[row][col]) rows.push_back(row);
+        if(rows.empty()) continue;
+
+        std::vector<int> smoothed(rows.size());
+        for(size_t i = 0; i < rows.size(); ++i)
+        {
+            int window[3] = {
+                table[rows[i ? i - 1 : i]][col],
+                table[rows[i]][col],
+                table[rows[i + 1 < rows.size() ? i + 1 : i]][col]
+            };
+            std::sort(window, window + 3);
+            smoothed[i] = window[1];
+        }
+
+        for(int row = 0, i = 0; row < table_rows; ++row)
+        {
+            while(i + 1 < int(rows.size()) && rows[i + 1] <= row) i++;
+            int nearest = i;
+            if(
+                i + 1 < int(rows.size()) &&
+                rows[i + 1] - row < std::abs(row - rows[i])
+            ) nearest = i + 1;
+            table[row][col] = smoothed[nearest];
+        }
+    }
+
+    for(int row = 0; row < table_rows; ++row)
+    {
+        int* entries = table[row];
+        int first = 0;
+        while(first < table_cols && !entries[first]) first++;
+        if(first == table_cols) continue;
+
+        for(int col = first - 1; col >= 0; --col)
+            entries[col] = std::max(entries[col + 1] / 2, 2);
+        for(int col = first + 1; col < table_cols; ++col)
+            if(!entries[col]) entries[col] = entries[col - 1];
+    }
+}
+
+void write_table(
+    FILE* out, const int table[table_rows][table_cols],
+    const tune_options& opt
+){
+    fprintf(
+        out,
+        "// Generated by patm-autotune (autotune.cc), don't edit by hand.\n"
+        "// Measured areas 2^%d-2^%d, mean rect sizes 2^%d-2^%d, %g s per\n"
+        "// candidate, canvas to rect size ratios up to %g.\n"
+        "#ifndef RECT_PACKER_CELL_SIZE_TABLE_HH\n"
+        "#define RECT_PACKER_CELL_SIZE_TABLE_HH\n"
+        "#include <cstdint>\n\n"
+        "// Row i is for canvas areas in [2^i, 2^(i+1)), column j for mean\n"
+        "// rect sizes ((w+h)/2) in [2^j, 2^(j+1)).\n"
+        "constexpr int cell_size_table_rows = %d;\n"
+        "constexpr int cell_size_table_cols = %d;\n"
+        "// Used until the packer has seen any rects.\n"
+        "constexpr int cell_size_table_default_col = %d;\n\n"
+        "constexpr std::uint16_t cell_size_table[%d][%d] = {\n",
+        opt.min_row, opt.max_row, opt.min_col, opt.max_col, opt.time,
+        opt.max_ratio, table_rows, table_cols, default_col, table_rows,
+        table_cols
+    );
+    for(int row = 0; row < table_rows; ++row)
+    {
+        fprintf(out, "    {");
+        for(int col = 0; col < table_cols; ++col)
+            fprintf(out, "%s%d", col ? ", " : "", table[row][col]);
+        fprintf(out, "}%s\n", row + 1 < table_rows ? "," : "");
+    }
+
+    // FNV-1a of the entries.
+    std::uint32_t id = 2166136261u;
+    for(int row = 0; row < table_rows; ++row)
+    for(int col = 0; col < table_cols; ++col)
+    {
+        id ^= std::uint32_t(table[row][col]);
+        id *= 16777619u;
+    }
+    fprintf(
+        out,
+        "};\n\n"
+        "// Identifies this table. Automatic cell sizes can change the\n"
+        "// placements slightly, so results stored elsewhere should be keyed\n"
+        "// by this.\n"
+        "constexpr std::uint32_t cell_size_table_id = 0x%08x;\n\n"
+        "#endif\n",
+        (unsigned)id
+    );
+}
+
+void print_usage(const char* program)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-o FILE] [--quick] [--time SECONDS] [--max-ratio N]\n"
+        "          [--seed N]\n",
+        program
+    );
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    tune_options opt;
+    const char* output = nullptr;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+        if(!strcmp(argv[i], "-o") && has_value)
+            output = argv[++i];
+        else if(!strcmp(argv[i], "--quick"))
+        {
+            opt.max_row = 18;
+            opt.time = 0.01;
+        }
+        else if(!strcmp(argv[i], "--time") && has_value)
+            opt.time = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--max-ratio") && has_value)
+            opt.max_ratio = std::max(atof(argv[++i]), 8.0);
+        else if(!strcmp(argv[i], "--seed") && has_value)
+            opt.seed = strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // A zero time would make every candidate look equally fast.
+    if(!(opt.time > 0))
+    {
+        fprintf(stderr, "--time must be positive\n");
+        return 1;
+    }
+
+    int table[table_rows][table_cols] = {};
+    for(int row = opt.min_row; row <= opt.max_row; ++row)
+    for(int col = opt.min_col; col <= opt.max_col; ++col)
+    {
+        // Rects that are too large for the canvas tell nothing, and tiny
+        // rects in a large canvas would take hours to pack.
+        double canvas = std::pow(2.0, (row + 0.5) / 2);
+        double size = std::pow(2.0, col + 0.5);
+        if(size * 8 > canvas || canvas / size > opt.max_ratio) continue;
+        table[row][col] = tune_entry(row, col, opt);
+    }
+    fill_table(table);
+
+    FILE* out = output ? fopen(output, "w") : stdout;
+    if(!out)
+    {
+        fprintf(stderr, "Failed to open %s\n", output);
+        return 1;
+    }
+    write_table(out, table, opt);
+    if(output) fclose(out);
+    return 0;
+}
@@ -0,0 +1,1208 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Headless benchmark. Runs a fixed matrix of scenarios with fixed seeds and
+// prints the results as JSON, so that they can be compared between versions.
+// Unlike the benchmarks in main.cc, this doesn't need SFML. With --corpus,
+// the inputs come from rect corpus files instead (see rect_corpus.hh), e.g.
+// the reference ones in corpora/.
+#include "rect_packer.hh"
+#include "rect_sets.hh"
+#include "occupancy.hh"
+#include "sharded_packer.hh"
+#include "packer_engines.hh"
+#include "rect_corpus.hh"
+#include "stb_rect_pack.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock bench_clock;
+
+double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+struct scenario
+{
+    const char* kind;
+    const char* set_name;
+    int w, h;
+    // Only used by guillotine scenarios.
+    unsigned splits;
+    // Only used by glyph scenarios.
+    glyph_distribution glyphs;
+    bool allow_rotation;
+    bool at_once;
+    // rect_packer's search mode, see rect_packer::set_corner_search().
+    bool corner_search;
+    int refine;
+};
+
+struct packer_result
+{
+    double time = 0;
+    std::uint64_t count = 0;
+    std::uint64_t packed = 0;
+    std::uint64_t area = 0;
+    // Set to false if any of the placements overlap or go out of bounds.
+    bool valid = true;
+};
+
+struct trial_result
+{
+    packer_result my, stb;
+    // rect_packer's free edge count at the end of the trial.
+    std::uint64_t edges = 0;
+};
+
+// Wraps both packers so that the trials can feed them identically.
+class stb_packer
+{
+public:
+    stb_packer(int w, int h)
+    : nodes(w)
+    {
+        stbrp_init_target(&ctx, w, h, nodes.data(), nodes.size());
+    }
+
+    // Returns the number of packed rects, and adds their area to 'area'.
+    int pack(
+        const std::vector<rect_packer::rect>& rects,
+        bool at_once,
+        std::uint64_t& area,
+        std::vector<occupancy_map::area>& placed
+    ){
+        tmp.clear();
+        for(const rect_packer::rect& r: rects)
+        {
+            tmp.push_back(
+                {0, (stbrp_coord)r.w, (stbrp_coord)r.h, 0, 0, 0}
+            );
+        }
+
+        if(at_once) stbrp_pack_rects(&ctx, tmp.data(), tmp.size());
+        else for(stbrp_rect& r: tmp) stbrp_pack_rects(&ctx, &r, 1);
+
+        int packed = 0;
+        for(const stbrp_rect& r: tmp)
+        {
+            if(!r.was_packed) continue;
+            packed++;
+            area += r.w * (std::uint64_t)r.h;
+            placed.push_back({r.x, r.y, r.w, r.h});
+        }
+        return packed;
+    }
+
+private:
+    stbrp_context ctx;
+    std::vector<stbrp_node> nodes;
+    std::vector<stbrp_rect> tmp;
+};
+
+int pack_with_rect_packer(
+    rect_packer& packer,
+    std::vector<rect_packer::rect>& rects,
+    bool at_once,
+    bool allow_rotation,
+    std::uint64_t& area,
+    std::vector<occupancy_map::area>& placed
+){
+    int packed = 0;
+    if(at_once)
+        packed = packer.pack(rects.data(), rects.size(), allow_rotation);
+    else for(rect_packer::rect& r: rects)
+    {
+        r.packed = allow_rotation ?
+            packer.pack_rotate(r.w, r.h, r.x, r.y, r.rotated) :
+            packer.pack(r.w, r.h, r.x, r.y);
+        if(r.packed) packed++;
+    }
+
+    for(const rect_packer::rect& r: rects)
+    {
+        if(!r.packed) continue;
+        area += r.w * (std::uint64_t)r.h;
+        if(r.rotated) placed.push_back({r.x, r.y, r.h, r.w});
+        else placed.push_back({r.x, r.y, r.w, r.h});
+    }
+    return packed;
+}
+
+// Packs one whole guillotine set. It fits perfectly, so the interesting part
+// is how close to 100% each packer gets.
+trial_result run_guillotine_trial(const scenario& s, unsigned seed)
+{
+    trial_result res;
+    std::vector<rect_packer::rect> rects = generate_guillotine_set(
+        s.w, s.h, s.splits, seed
+    );
+    std::vector<rect_packer::rect> queue;
+    for(const rect_packer::rect& r: rects) queue.push_back({r.w, r.h});
+
+    rect_packer packer(s.w, s.h, false);
+    packer.set_corner_search(s.corner_search, s.refine);
+    std::vector<occupancy_map::area> placed;
+    placed.reserve(queue.size());
+    bench_clock::time_point start = bench_clock::now();
+    res.my.packed = pack_with_rect_packer(
+        packer, queue, s.at_once, s.allow_rotation, res.my.area, placed
+    );
+    res.my.time = seconds_since(start);
+    res.my.count = queue.size();
+    res.edges = packer.get_edge_count();
+    res.my.valid = occupancy_map::validate(
+        s.w, s.h, placed.data(), placed.size(), 1
+    );
+
+    stb_packer stb(s.w, s.h);
+    std::vector<occupancy_map::area> stb_placed;
+    stb_placed.reserve(queue.size());
+    start = bench_clock::now();
+    res.stb.packed = stb.pack(queue, s.at_once, res.stb.area, stb_placed);
+    res.stb.time = seconds_since(start);
+    res.stb.count = queue.size();
+    res.stb.valid = occupancy_map::validate(
+        s.w, s.h, stb_placed.data(), stb_placed.size(), 1
+    );
+    return res;
+}
+
+// Like glyph_test() in main.cc: groups of glyphs are packed until both
+// packers have failed to fit a group completely.
+trial_result run_glyph_trial(const scenario& s, unsigned seed)
+{
+    trial_result res;
+    glyph_generator gen(s.glyphs, seed);
+
+    rect_packer packer(s.w, s.h, false);
+    packer.set_corner_search(s.corner_search, s.refine);
+    stb_packer stb(s.w, s.h);
+    std::vector<occupancy_map::area> placed, stb_placed;
+    bool my_full = false, stb_full = false;
+
+    while(!my_full || !stb_full)
+    {
+        std::vector<rect_packer::rect> group = gen.next_group();
+        unsigned group_size = group.size();
+
+        if(!my_full)
+        {
+            bench_clock::time_point start = bench_clock::now();
+            unsigned packed = pack_with_rect_packer(
+                packer, group, s.at_once, s.allow_rotation, res.my.area,
+                placed
+            );
+            res.my.time += seconds_since(start);
+            res.my.packed += packed;
+            res.my.count += group_size;
+            if(packed != group_size) my_full = true;
+        }
+
+        if(!stb_full)
+        {
+            bench_clock::time_point start = bench_clock::now();
+            unsigned packed = stb.pack(
+                group, s.at_once, res.stb.area, stb_placed
+            );
+            res.stb.time += seconds_since(start);
+            res.stb.packed += packed;
+            res.stb.count += group_size;
+            if(packed != group_size) stb_full = true;
+        }
+    }
+    res.my.valid = occupancy_map::validate(
+        s.w, s.h, placed.data(), placed.size(), 1
+    );
+    res.stb.valid = occupancy_map::validate(
+        s.w, s.h, stb_placed.data(), stb_placed.size(), 1
+    );
+    res.edges = packer.get_edge_count();
+    return res;
+}
+
+std::vector<scenario> build_matrix(bool quick)
+{
+    std::vector<scenario> matrix;
+    std::vector<int> guillotine_sizes = {256, 512, 1024};
+    std::vector<int> glyph_sizes = {512, 1024};
+    if(quick)
+    {
+        guillotine_sizes = {256};
+        glyph_sizes = {512};
+    }
+
+    struct named_glyphs { const char* name; glyph_distribution dist; };
+    std::vector<named_glyphs> glyph_sets = {
+        {"latin", {10, 3, 16, 3, 100, 20}},
+        {"cjk", {24, 2, 24, 2, 400, 50}},
+        {"large", {50, 15, 80, 15, 2000, 1}}
+    };
+
+    for(int at_once = 1; at_once >= 0; --at_once)
+    for(int rotation = 0; rotation <= 1; ++rotation)
+    {
+        for(int size: guillotine_sizes)
+        {
+            scenario s = {};
+            s.kind = "guillotine";
+            s.set_name = "guillotine";
+            s.w = s.h = size;
+            s.splits = size * 2;
+            s.allow_rotation = rotation;
+            s.at_once = at_once;
+            matrix.push_back(s);
+        }
+
+        for(const named_glyphs& g: glyph_sets)
+        for(int size: glyph_sizes)
+        {
+            scenario s = {};
+            s.kind = "glyph";
+            s.set_name = g.name;
+            s.w = s.h = size;
+            s.glyphs = g.dist;
+            s.allow_rotation = rotation;
+            s.at_once = at_once;
+            matrix.push_back(s);
+        }
+    }
+    return matrix;
+}
+
+// Several threads pack glyphs one by one into one shared atlas, either
+// through a rect_packer behind a global mutex or a sharded_rect_packer. The
+// total number of rects stays the same regardless of the thread count.
+struct contention_result
+{
+    packer_result result;
+    std::uint64_t cross_shard = 0;
+};
+
+contention_result run_contention_trial(
+    bool sharded, unsigned threads, int size, int shards,
+    unsigned rect_count, unsigned seed
+){
+    std::vector<std::vector<rect_packer::rect>> work(threads);
+    for(unsigned i = 0; i < threads; ++i)
+    {
+        glyph_generator gen({10, 3, 16, 3, 100, 20}, seed * 16 + i);
+        unsigned count = rect_count / threads + (i < rect_count % threads);
+        while(work[i].size() < count)
+        {
+            for(const rect_packer::rect& r: gen.next_group())
+                if(work[i].size() < count) work[i].push_back(r);
+        }
+    }
+
+    rect_packer packer(size, size, false);
+    std::mutex packer_mutex;
+    sharded_rect_packer sharded_packer(size, size, shards, shards);
+
+    std::vector<std::vector<occupancy_map::area>> placed(threads);
+    std::atomic<unsigned> ready(0);
+    auto worker = [&](unsigned index){
+        ready++;
+        while(ready.load() != threads + 1) std::this_thread::yield();
+        for(rect_packer::rect& r: work[index])
+        {
+            if(sharded) r.packed = sharded_packer.pack(r.w, r.h, r.x, r.y);
+            else
+            {
+                std::lock_guard<std::mutex> lock(packer_mutex);
+                r.packed = packer.pack(r.w, r.h, r.x, r.y);
+            }
+            if(r.packed) placed[index].push_back({r.x, r.y, r.w, r.h});
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 0; i < threads; ++i) pool.emplace_back(worker, i);
+    while(ready.load() != threads) std::this_thread::yield();
+    bench_clock::time_point start = bench_clock::now();
+    ready++;
+    for(std::thread& t: pool) t.join();
+
+    contention_result res;
+    res.result.time = seconds_since(start);
+    std::vector<occupancy_map::area> all_placed;
+    for(unsigned i = 0; i < threads; ++i)
+    {
+        res.result.count += work[i].size();
+        for(const occupancy_map::area& a: placed[i])
+        {
+            res.result.packed++;
+            res.result.area += a.w * (std::uint64_t)a.h;
+            all_placed.push_back(a);
+        }
+    }
+    res.result.valid = occupancy_map::validate(
+        size, size, all_placed.data(), all_placed.size()
+    );
+    if(sharded) res.cross_shard = sharded_packer.get_cross_shard_count();
+    return res;
+}
+
+int run_contention_bench(unsigned trials, unsigned seed, bool quick, int shards)
+{
+    int size = quick ? 512 : 1024;
+    unsigned rect_count = quick ? 1200 : 5000;
+    std::vector<unsigned> thread_counts = {1, 2, 4, 8, 16};
+    bool valid = true;
+
+    printf("{\n");
+    printf("  \"trials\": %u,\n  \"seed\": %u,\n", trials, seed);
+    printf(
+        "  \"canvas\": [%d, %d],\n  \"rects\": %u,\n  \"shards\": [%d, %d],\n",
+        size, size, rect_count, shards, shards
+    );
+    printf("  \"contention\": [\n");
+    for(int sharded = 0; sharded <= 1; ++sharded)
+    for(unsigned i = 0; i < thread_counts.size(); ++i)
+    {
+        contention_result total;
+        for(unsigned j = 0; j < trials; ++j)
+        {
+            contention_result t = run_contention_trial(
+                sharded, thread_counts[i], size, shards, rect_count, seed + j
+            );
+            total.result.time += t.result.time;
+            total.result.count += t.result.count;
+            total.result.packed += t.result.packed;
+            total.result.area += t.result.area;
+            total.result.valid = total.result.valid && t.result.valid;
+            total.cross_shard += t.cross_shard;
+        }
+        valid = valid && total.result.valid;
+
+        const packer_result& r = total.result;
+        printf(
+            "    {\"packer\": \"%s\", \"threads\": %u, \"time\": %f, "
+            "\"packed\": %llu, \"rects_per_second\": %f, "
+            "\"rect_rate\": %f, \"coverage\": %f, \"cross_shard\": %llu, "
+            "\"valid\": %s}%s\n",
+            sharded ? "sharded" : "mutex", thread_counts[i], r.time,
+            (unsigned long long)r.packed,
+            r.time > 0 ? r.count / r.time : 0.0,
+            r.count ? r.packed / (double)r.count : 0.0,
+            r.area / (size * (double)size * trials),
+            (unsigned long long)total.cross_shard,
+            r.valid ? "true" : "false",
+            sharded && i + 1 == thread_counts.size() ? "" : ","
+        );
+    }
+    printf("  ]\n}\n");
+
+    if(!valid)
+    {
+        fprintf(stderr, "A packer produced an invalid layout!\n");
+        return 2;
+    }
+    return 0;
+}
+
+// One batch of glyphs that would fill 95% of the canvas, packed either by
+// one rect_packer or by a sharded_rect_packer in tiled mode with 256x256
+// tiles.
+packer_result run_tiled_trial(
+    bool tiled, int size, unsigned threads, unsigned seed
+){
+    std::vector<rect_packer::rect> rects;
+    glyph_generator gen({10, 3, 16, 3, 100, 20}, seed);
+    std::uint64_t area = 0;
+    while(area < size * (std::uint64_t)size * 19 / 20)
+    {
+        for(const rect_packer::rect& r: gen.next_group())
+        {
+            rects.push_back(r);
+            area += r.w * (std::uint64_t)r.h;
+        }
+    }
+
+    packer_result res;
+    res.count = rects.size();
+    bench_clock::time_point start = bench_clock::now();
+    if(tiled)
+    {
+        int tiles = std::max(size / 256, 1);
+        sharded_rect_packer packer(size, size, tiles, tiles);
+        res.packed = packer.pack(rects.data(), rects.size(), false, threads);
+    }
+    else
+    {
+        rect_packer packer(size, size, false);
+        res.packed = packer.pack(rects.data(), rects.size(), false);
+    }
+    res.time = seconds_since(start);
+
+    std::vector<occupancy_map::area> placed;
+    for(const rect_packer::rect& r: rects)
+    {
+        if(!r.packed) continue;
+        res.area += r.w * (std::uint64_t)r.h;
+        placed.push_back({r.x, r.y, r.w, r.h});
+    }
+    res.valid = occupancy_map::validate(
+        size, size, placed.data(), placed.size()
+    );
+    return res;
+}
+
+int run_tiled_bench(
+    unsigned trials, unsigned seed, bool quick, unsigned threads
+){
+    std::vector<int> sizes = {512, 1024, 2048};
+    if(quick) sizes = {512, 1024};
+    bool valid = true;
+
+    printf("{\n");
+    printf("  \"trials\": %u,\n  \"threads\": %u,\n", trials, threads);
+    printf("  \"seed\": %u,\n", seed);
+    printf("  \"tiled\": [\n");
+    for(unsigned i = 0; i < sizes.size(); ++i)
+    for(int tiled = 0; tiled <= 1; ++tiled)
+    {
+        packer_result total;
+        for(unsigned j = 0; j < trials; ++j)
+        {
+            packer_result t = run_tiled_trial(
+                tiled, sizes[i], threads, seed + j
+            );
+            total.time += t.time;
+            total.count += t.count;
+            total.packed += t.packed;
+            total.area += t.area;
+            total.valid = total.valid && t.valid;
+        }
+        valid = valid && total.valid;
+
+        int size = sizes[i];
+        printf(
+            "    {\"packer\": \"%s\", \"canvas\": [%d, %d], "
+            "\"tiles\": %d, \"time\": %f, \"rects\": %llu, "
+            "\"time_per_rect\": %g, \"rect_rate\": %f, \"coverage\": %f, "
+            "\"valid\": %s}%s\n",
+            tiled ? "tiled" : "rect_packer", size, size,
+            tiled ? std::max(size / 256, 1) : 1, total.time,
+            (unsigned long long)total.count,
+            total.count ? total.time / total.count : 0.0,
+            total.count ? total.packed / (double)total.count : 0.0,
+            total.area / (size * (double)size * trials),
+            total.valid ? "true" : "false",
+            tiled && i + 1 == sizes.size() ? "" : ","
+        );
+    }
+    printf("  ]\n}\n");
+
+    if(!valid)
+    {
+        fprintf(stderr, "A packer produced an invalid layout!\n");
+        return 2;
+    }
+    return 0;
+}
+
+// Runs one matrix scenario with any engine. Glyph groups are packed until one
+// doesn't fit completely, like in run_glyph_trial().
+packer_result run_engine_trial(
+    const scenario& s, const char* engine_name, unsigned seed
+){
+    packer_result res;
+    std::unique_ptr<packer_engine> engine = make_packer_engine(
+        engine_name, s.w, s.h
+    );
+    std::vector<occupancy_map::area> placed;
+    auto pack_group = [&](std::vector<rect_packer::rect>& rects){
+        bench_clock::time_point start = bench_clock::now();
+        int packed = 0;
+        if(s.at_once)
+            packed = engine->pack(rects.data(), rects.size(), s.allow_rotation);
+        else for(rect_packer::rect& r: rects)
+        {
+            r.packed = s.allow_rotation ?
+                engine->pack_rotate(r.w, r.h, r.x, r.y, r.rotated) :
+                engine->pack(r.w, r.h, r.x, r.y);
+            if(r.packed) packed++;
+        }
+        res.time += seconds_since(start);
+        res.count += rects.size();
+        res.packed += packed;
+
+        for(const rect_packer::rect& r: rects)
+        {
+            if(!r.packed) continue;
+            res.area += r.w * (std::uint64_t)r.h;
+            if(r.rotated) placed.push_back({r.x, r.y, r.h, r.w});
+            else placed.push_back({r.x, r.y, r.w, r.h});
+        }
+        return packed == (int)rects.size();
+    };
+
+    if(!strcmp(s.kind, "guillotine"))
+    {
+        std::vector<rect_packer::rect> queue;
+        for(const rect_packer::rect& r: generate_guillotine_set(
+            s.w, s.h, s.splits, seed
+        )) queue.push_back({r.w, r.h});
+        pack_group(queue);
+    }
+    else
+    {
+        glyph_generator gen(s.glyphs, seed);
+        for(;;)
+        {
+            std::vector<rect_packer::rect> group = gen.next_group();
+            if(!pack_group(group)) break;
+        }
+    }
+
+    res.valid = occupancy_map::validate(
+        s.w, s.h, placed.data(), placed.size()
+    );
+    return res;
+}
+
+// Every engine on the same scenarios as the default matrix. The trials run
+// one at a time so that the engines' times are comparable.
+int run_engine_bench(unsigned trials, unsigned seed, bool quick)
+{
+    std::vector<scenario> matrix = build_matrix(quick);
+    bool valid = true;
+
+    printf("{\n");
+    printf("  \"trials\": %u,\n  \"seed\": %u,\n", trials, seed);
+    printf("  \"engines\": [\n");
+    for(unsigned i = 0; i < matrix.size(); ++i)
+    for(size_t e = 0; e < packer_engine_count; ++e)
+    {
+        const scenario& s = matrix[i];
+        packer_result total;
+        for(unsigned j = 0; j < trials; ++j)
+        {
+            packer_result t = run_engine_trial(
+                s, packer_engine_names[e], seed + j
+            );
+            total.time += t.time;
+            total.count += t.count;
+            total.packed += t.packed;
+            total.area += t.area;
+            total.valid = total.valid && t.valid;
+        }
+        valid = valid && total.valid;
+
+        printf(
+            "    {\"engine\": \"%s\", \"set\": \"%s\", "
+            "\"canvas\": [%d, %d], \"rotation\": %s, \"mode\": \"%s\", "
+            "\"time\": %f, \"rects\": %llu, \"packed\": %llu, "
+            "\"coverage\": %f, \"valid\": %s}%s\n",
+            packer_engine_names[e], s.set_name, s.w, s.h,
+            s.allow_rotation ? "true" : "false",
+            s.at_once ? "batch" : "one-by-one", total.time,
+            (unsigned long long)total.count, (unsigned long long)total.packed,
+            total.area / (s.w * (double)s.h * trials),
+            total.valid ? "true" : "false",
+            i + 1 == matrix.size() && e + 1 == packer_engine_count ? "" : ","
+        );
+    }
+    printf("  ]\n}\n");
+
+    if(!valid)
+    {
+        fprintf(stderr, "An engine produced an invalid layout!\n");
+        return 2;
+    }
+    return 0;
+}
+
+// Runs one matrix scenario with rect_packer or with one of its fixed-policy
+// variants. Glyph groups are packed until one doesn't fit completely, like
+// in run_glyph_trial().
+template<typename packer_type>
+packer_result run_policy_trial(const scenario& s, unsigned seed)
+{
+    typedef typename packer_type::rect rect;
+    packer_result res;
+    packer_type packer(s.w, s.h, false);
+    std::vector<occupancy_map::area> placed;
+    std::vector<rect> queue;
+    auto pack_group = [&](const std::vector<rect_packer::rect>& group){
+        queue.clear();
+        for(const rect_packer::rect& r: group) queue.push_back({r.w, r.h});
+
+        bench_clock::time_point start = bench_clock::now();
+        int packed = 0;
+        if(s.at_once)
+            packed = packer.pack(queue.data(), queue.size(), s.allow_rotation);
+        else for(rect& r: queue)
+        {
+            r.packed = s.allow_rotation ?
+                packer.pack_rotate(r.w, r.h, r.x, r.y, r.rotated) :
+                packer.pack(r.w, r.h, r.x, r.y);
+            if(r.packed) packed++;
+        }
+        res.time += seconds_since(start);
+        res.count += queue.size();
+        res.packed += packed;
+
+        for(const rect& r: queue)
+        {
+            if(!r.packed) continue;
+            res.area += r.w * (std::uint64_t)r.h;
+            if(r.rotated) placed.push_back({r.x, r.y, r.h, r.w});
+            else placed.push_back({r.x, r.y, r.w, r.h});
+        }
+        return packed == (int)queue.size();
+    };
+
+    if(!strcmp(s.kind, "guillotine"))
+        pack_group(generate_guillotine_set(s.w, s.h, s.splits, seed));
+    else
+    {
+        glyph_generator gen(s.glyphs, seed);
+        while(pack_group(gen.next_group()));
+    }
+
+    res.valid = occupancy_map::validate(
+        s.w, s.h, placed.data(), placed.size()
+    );
+    return res;
+}
+
+// rect_packer against basic_rect_packer with the same settings fixed at
+// compile time, on the scenarios of the default matrix. Both get the same
+// rects and should give the same layouts, so only the times should differ.
+// The trials alternate between the two and run one at a time.
+int run_policy_bench(unsigned trials, unsigned seed, bool quick)
+{
+    std::vector<scenario> matrix = build_matrix(quick);
+    bool valid = true;
+
+    printf("{\n");
+    printf("  \"trials\": %u,\n  \"seed\": %u,\n", trials, seed);
+    printf("  \"policies\": [\n");
+    for(unsigned i = 0; i < matrix.size(); ++i)
+    {
+        const scenario& s = matrix[i];
+        packer_result runtime, fixed;
+        for(unsigned j = 0; j < trials; ++j)
+        {
+            packer_result t[2];
+            t[0] = run_policy_trial<rect_packer>(s, seed + j);
+            t[1] = s.allow_rotation ?
+                run_policy_trial<
+                    basic_rect_packer<int, closed_canvas, always_rotation>
+                >(s, seed + j) :
+                run_policy_trial<
+                    basic_rect_packer<int, closed_canvas, no_rotation>
+                >(s, seed + j);
+            for(int k = 0; k < 2; ++k)
+            {
+                packer_result& dst = k == 0 ? runtime : fixed;
+                dst.time += t[k].time;
+                dst.count += t[k].count;
+                dst.packed += t[k].packed;
+                dst.area += t[k].area;
+                dst.valid = dst.valid && t[k].valid;
+            }
+        }
+        valid = valid && runtime.valid && fixed.valid;
+
+        printf(
+            "    {\"set\": \"%s\", \"canvas\": [%d, %d], "
+            "\"rotation\": %s, \"mode\": \"%s\", "
+            "\"runtime_time\": %f, \"fixed_time\": %f, \"speedup\": %f, "
+            "\"runtime_packed\": %llu, \"fixed_packed\": %llu, "
+            "\"valid\": %s}%s\n",
+            s.set_name, s.w, s.h, s.allow_rotation ? "true" : "false",
+            s.at_once ? "batch" : "one-by-one", runtime.time, fixed.time,
+            fixed.time > 0 ? runtime.time / fixed.time : 0.0,
+            (unsigned long long)runtime.packed,
+            (unsigned long long)fixed.packed,
+            runtime.valid && fixed.valid ? "true" : "false",
+            i + 1 < matrix.size() ? "," : ""
+        );
+    }
+    printf("  ]\n}\n");
+
+    if(!valid)
+    {
+        fprintf(stderr, "A packer produced an invalid layout!\n");
+        return 2;
+    }
+    return 0;
+}
+
+// Checks a layout like occupancy_map::validate(), but pair by pair in 64
+// bits, since a bitmap of a canvas at the size limit wouldn't fit in memory.
+bool validate_pairwise(
+    int w, int h, const std::vector<occupancy_map::area>& placed
+){
+    auto end = [](int pos, int size){ return std::int64_t(pos) + size; };
+    for(size_t i = 0; i < placed.size(); ++i)
+    {
+        const occupancy_map::area& a = placed[i];
+        if(
+            a.x < 0 || a.y < 0 || a.w <= 0 || a.h <= 0 ||
+            end(a.x, a.w) > w || end(a.y, a.h) > h
+        ) return false;
+        for(size_t j = 0; j < i; ++j)
+        {
+            const occupancy_map::area& b = placed[j];
+            if(
+                a.x < end(b.x, b.w) && b.x < end(a.x, a.w) &&
+                a.y < end(b.y, b.h) && b.y < end(a.y, a.h)
+            ) return false;
+        }
+    }
+    return true;
+}
+
+// Packs a guillotine set cut from a canvas at get_max_size(), so that both
+// the rects and the canvas are at the limit. With grow, the packer starts
+// from a small open canvas and has to grow all the way there.
+template<typename packer_type>
+packer_result run_limits_trial(
+    bool at_once, bool grow, unsigned seed, int& lookup_size
+){
+    typedef typename packer_type::rect rect;
+    int size = packer_type::get_max_size();
+    packer_result res;
+    packer_type packer(grow ? 64 : size, grow ? 64 : size, grow);
+    if(grow)
+    {
+        typename packer_type::growth_policy policy;
+        policy.max_w = policy.max_h = size;
+        packer.set_growth(policy);
+    }
+
+    std::vector<rect> rects;
+    std::vector<rect_packer::rect> set = generate_guillotine_set(
+        size, size, 64, seed
+    );
+    for(const rect_packer::rect& r: set) rects.push_back({r.w, r.h});
+
+    bench_clock::time_point start = bench_clock::now();
+    if(at_once) res.packed = packer.pack(rects.data(), rects.size(), true);
+    else for(rect& r: rects)
+    {
+        r.packed = packer.pack_rotate(r.w, r.h, r.x, r.y, r.rotated);
+        if(r.packed) res.packed++;
+    }
+    res.time = seconds_since(start);
+    res.count = rects.size();
+
+    std::vector<occupancy_map::area> placed;
+    for(const rect& r: rects)
+    {
+        if(!r.packed) continue;
+        res.area += r.w * (std::uint64_t)r.h;
+        if(r.rotated) placed.push_back({r.x, r.y, r.h, r.w});
+        else placed.push_back({r.x, r.y, r.w, r.h});
+    }
+    res.valid = validate_pairwise(
+        packer.get_width(), packer.get_height(), placed
+    );
+    lookup_size = std::max(
+        packer.get_lookup_width(), packer.get_lookup_height()
+    );
+    return res;
+}
+
+// Both coordinate types at their largest canvas, closed and grown, batch and
+// one-by-one. This is a check more than a benchmark: the layouts must be
+// valid and the lookup must stay small however large the canvas is.
+int run_limits_bench(unsigned trials, unsigned seed)
+{
+    bool valid = true;
+    printf("{\n");
+    printf("  \"trials\": %u,\n  \"seed\": %u,\n", trials, seed);
+    printf("  \"limits\": [\n");
+    for(int type = 0; type < 2; ++type)
+    for(int grow = 0; grow < 2; ++grow)
+    for(int at_once = 1; at_once >= 0; --at_once)
+    {
+        packer_result total;
+        int lookup_size = 0;
+        for(unsigned j = 0; j < trials; ++j)
+        {
+            int trial_lookup = 0;
+            packer_result t = type == 0 ?
+                run_limits_trial<rect_packer>(
+                    at_once, grow, seed + j, trial_lookup
+                ) :
+                run_limits_trial<compact_rect_packer>(
+                    at_once, grow, seed + j, trial_lookup
+                );
+            total.time += t.time;
+            total.count += t.count;
+            total.packed += t.packed;
+            total.valid = total.valid && t.valid;
+            lookup_size = std::max(lookup_size, trial_lookup);
+        }
+        valid = valid && total.valid;
+
+        printf(
+            "    {\"packer\": \"%s\", \"canvas\": %d, \"grow\": %s, "
+            "\"mode\": \"%s\", \"time\": %f, \"rects\": %llu, "
+            "\"packed\": %llu, \"lookup_size\": %d, \"valid\": %s}%s\n",
+            type == 0 ? "rect_packer" : "compact_rect_packer",
+            type == 0 ? rect_packer::get_max_size() :
+                compact_rect_packer::get_max_size(),
+            grow ? "true" : "false", at_once ? "batch" : "one-by-one",
+            total.time, (unsigned long long)total.count,
+            (unsigned long long)total.packed, lookup_size,
+            total.valid ? "true" : "false",
+            type == 1 && grow == 1 && at_once == 0 ? "" : ","
+        );
+    }
+    printf("  ]\n}\n");
+
+    if(!valid)
+    {
+        fprintf(stderr, "A packer produced an invalid layout!\n");
+        return 2;
+    }
+    return 0;
+}
+
+// Packs the groups of a corpus in order into its canvas, with both packers.
+// Groups that don't fit are skipped over, so every group gets tried.
+trial_result run_corpus_trial(
+    const rect_corpus& corpus, bool at_once, bool allow_rotation
+){
+    trial_result res;
+    int w = corpus.get_canvas_w(), h = corpus.get_canvas_h();
+    rect_packer packer(w, h, false);
+    stb_packer stb(w, h);
+    std::vector<occupancy_map::area> placed, stb_placed;
+    std::vector<rect_packer::rect> group;
+
+    for(size_t g = 0; g < corpus.get_group_count(); ++g)
+    {
+        group.clear();
+        corpus.get_group(g, group);
+        res.my.count += group.size();
+        res.stb.count += group.size();
+
+        bench_clock::time_point start = bench_clock::now();
+        res.my.packed += pack_with_rect_packer(
+            packer, group, at_once, allow_rotation, res.my.area, placed
+        );
+        res.my.time += seconds_since(start);
+
+        start = bench_clock::now();
+        res.stb.packed += stb.pack(group, at_once, res.stb.area, stb_placed);
+        res.stb.time += seconds_since(start);
+    }
+
+    res.my.valid = occupancy_map::validate(
+        w, h, placed.data(), placed.size()
+    );
+    res.stb.valid = occupancy_map::validate(
+        w, h, stb_placed.data(), stb_placed.size()
+    );
+    res.edges = packer.get_edge_count();
+    return res;
+}
+
+void print_packer_result(
+    const char* name, const packer_result& r, const scenario& s,
+    unsigned trials
+){
+    double area = s.w * (double)s.h * trials;
+    printf(
+        "      \"%s\": {\"time\": %f, \"rects\": %llu, \"packed\": %llu, "
+        "\"rects_per_second\": %f, \"rect_rate\": %f, \"coverage\": %f, "
+        "\"valid\": %s}",
+        name, r.time, (unsigned long long)r.count,
+        (unsigned long long)r.packed,
+        r.time > 0 ? r.count / r.time : 0.0,
+        r.count ? r.packed / (double)r.count : 0.0,
+        r.area / area,
+        r.valid ? "true" : "false"
+    );
+}
+
+// Every corpus in batch and one-by-one mode, without rotation. The corpora
+// are mapped once and shared by all trials, which run one at a time.
+int run_corpus_bench(const std::vector<const char*>& paths, unsigned trials)
+{
+    bool valid = true;
+    printf("{\n");
+    printf("  \"trials\": %u,\n", trials);
+    printf("  \"corpora\": [\n");
+    for(size_t i = 0; i < paths.size(); ++i)
+    {
+        rect_corpus corpus;
+        if(!corpus.open(paths[i]))
+        {
+            fprintf(stderr, "%s is not a valid rect corpus\n", paths[i]);
+            return 1;
+        }
+
+        for(int at_once = 1; at_once >= 0; --at_once)
+        {
+            scenario s = {};
+            s.w = corpus.get_canvas_w();
+            s.h = corpus.get_canvas_h();
+            s.at_once = at_once;
+            trial_result total;
+            for(unsigned j = 0; j < trials; ++j)
+            {
+                trial_result t = run_corpus_trial(corpus, at_once, false);
+                total.edges += t.edges;
+                for(int k = 0; k < 2; ++k)
+                {
+                    packer_result& dst = k == 0 ? total.my : total.stb;
+                    const packer_result& src = k == 0 ? t.my : t.stb;
+                    dst.time += src.time;
+                    dst.count += src.count;
+                    dst.packed += src.packed;
+                    dst.area += src.area;
+                    dst.valid = dst.valid && src.valid;
+                }
+            }
+            valid = valid && total.my.valid && total.stb.valid;
+
+            printf("    {\n");
+            printf(
+                "      \"corpus\": \"%s\", \"groups\": %zu, "
+                "\"canvas\": [%d, %d], \"mapped\": %s,\n",
+                paths[i], corpus.get_group_count(), s.w, s.h,
+                corpus.is_mapped() ? "true" : "false"
+            );
+            printf(
+                "      \"rotation\": false, \"mode\": \"%s\",\n",
+                at_once ? "batch" : "one-by-one"
+            );
+            print_packer_result("rect_packer", total.my, s, trials);
+            printf(",\n");
+            print_packer_result("stb_rect_pack", total.stb, s, trials);
+            printf(
+                ",\n      \"final_edges\": %f\n",
+                total.edges / (double)trials
+            );
+            printf(
+                "    }%s\n",
+                i + 1 == paths.size() && !at_once ? "" : ","
+            );
+        }
+    }
+    printf("  ]\n}\n");
+
+    if(!valid)
+    {
+        fprintf(stderr, "A packer produced an invalid layout!\n");
+        return 2;
+    }
+    return 0;
+}
+
+void print_usage(const char* program)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [--trials N] [--threads N] [--seed N] [--quick]\n"
+        "          [--corner-search] [--refine N]\n"
+        "          [--contention] [--shards N] [--tiled] [--engines]\n"
+        "          [--policies] [--limits] [--corpus FILE]...\n",
+        program
+    );
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    unsigned trials = 8;
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned seed = 0;
+    bool quick = false;
+    bool corner_search = false;
+    int refine = 0;
+    bool contention = false;
+    int shards = 4;
+    bool tiled = false;
+    bool engines = false;
+    bool policies = false;
+    bool limits = false;
+    std::vector<const char*> corpora;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+        if(!strcmp(argv[i], "--trials") && has_value)
+            trials = std::max(atoi(argv[++i]), 1);
+        else if(!strcmp(argv[i], "--threads") && has_value)
+            threads = std::max(atoi(argv[++i]), 1);
+        else if(!strcmp(argv[i], "--seed") && has_value)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if(!strcmp(argv[i], "--quick"))
+            quick = true;
+        else if(!strcmp(argv[i], "--corner-search"))
+            corner_search = true;
+        else if(!strcmp(argv[i], "--refine") && has_value)
+            refine = std::max(atoi(argv[++i]), 0);
+        else if(!strcmp(argv[i], "--contention"))
+            contention = true;
+        else if(!strcmp(argv[i], "--shards") && has_value)
+            shards = std::max(atoi(argv[++i]), 1);
+        else if(!strcmp(argv[i], "--tiled"))
+            tiled = true;
+        else if(!strcmp(argv[i], "--engines"))
+            engines = true;
+        else if(!strcmp(argv[i], "--policies"))
+            policies = true;
+        else if(!strcmp(argv[i], "--limits"))
+            limits = true;
+        else if(!strcmp(argv[i], "--corpus") && has_value)
+            corpora.push_back(argv[++i]);
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The contention, tiled, engine, policy, limit and corpus benchmarks
+    // replace the matrix, since the matrix runs trials in parallel and would
+    // skew their timings.
+    if(contention) return run_contention_bench(trials, seed, quick, shards);
+    if(tiled) return run_tiled_bench(trials, seed, quick, threads);
+    if(engines) return run_engine_bench(trials, seed, quick);
+    if(policies) return run_policy_bench(trials, seed, quick);
+    if(limits) return run_limits_bench(trials, seed);
+    if(!corpora.empty()) return run_corpus_bench(corpora, trials);
+
+    std::vector<scenario> matrix = build_matrix(quick);
+    for(scenario& s: matrix)
+    {
+        s.corner_search = corner_search;
+        s.refine = refine;
+    }
+    std::vector<trial_result> results(matrix.size() * trials);
+
+    // Trials are independent, so they're simply handed out to the workers in
+    // order. Each trial always gets the same seed regardless of the thread.
+    std::atomic<unsigned> next_job(0);
+    auto worker = [&](){
+        for(;;)
+        {
+            unsigned job = next_job++;
+            if(job >= results.size()) break;
+            const scenario& s = matrix[job / trials];
+            unsigned trial_seed = seed + job % trials;
+            if(!strcmp(s.kind, "guillotine"))
+                results[job] = run_guillotine_trial(s, trial_seed);
+            else
+                results[job] = run_glyph_trial(s, trial_seed);
+        }
+    };
+
+    bench_clock::time_point start = bench_clock::now();
+    std::vector<std::thread> pool;
+    for(unsigned i = 0; i < threads; ++i) pool.emplace_back(worker);
+    for(std::thread& t: pool) t.join();
+    double wall_time = seconds_since(start);
+
+    printf("{\n");
+    printf("  \"trials\": %u,\n  \"threads\": %u,\n", trials, threads);
+    printf("  \"seed\": %u,\n  \"wall_time\": %f,\n", seed, wall_time);
+    printf(
+        "  \"search\": \"%s\",\n  \"refine\": %d,\n",
+        corner_search ? "corner" : "exhaustive", refine
+    );
+    printf("  \"scenarios\": [\n");
+    for(unsigned i = 0; i < matrix.size(); ++i)
+    {
+        const scenario& s = matrix[i];
+        trial_result total;
+        for(unsigned j = 0; j < trials; ++j)
+        {
+            const trial_result& t = results[i * trials + j];
+            total.edges += t.edges;
+            for(int k = 0; k < 2; ++k)
+            {
+                packer_result& dst = k == 0 ? total.my : total.stb;
+                const packer_result& src = k == 0 ? t.my : t.stb;
+                dst.time += src.time;
+                dst.count += src.count;
+                dst.packed += src.packed;
+                dst.area += src.area;
+                dst.valid = dst.valid && src.valid;
+            }
+        }
+
+        printf("    {\n");
+        printf(
+            "      \"kind\": \"%s\", \"set\": \"%s\", "
+            "\"canvas\": [%d, %d],\n",
+            s.kind, s.set_name, s.w, s.h
+        );
+        if(!strcmp(s.kind, "guillotine"))
+            printf("      \"splits\": %u,\n", s.splits);
+        printf(
+            "      \"rotation\": %s, \"mode\": \"%s\",\n",
+            s.allow_rotation ? "true" : "false",
+            s.at_once ? "batch" : "one-by-one"
+        );
+        print_packer_result("rect_packer", total.my, s, trials);
+        printf(",\n");
+        print_packer_result("stb_rect_pack", total.stb, s, trials);
+        printf(
+            ",\n      \"final_edges\": %f",
+            total.edges / (double)trials
+        );
+        printf(
+            ",\n      \"advantage\": %f\n",
+            total.stb.packed ? total.my.packed / (double)total.stb.packed - 1.0
+                : 0.0
+        );
+        printf("    }%s\n", i + 1 < matrix.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    for(const trial_result& t: results)
+    {
+        if(!t.my.valid)
+        {
+            fprintf(stderr, "rect_packer produced an invalid layout!\n");
+            return 2;
+        }
+    }
+    return 0;
+}
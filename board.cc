@@ -30,15 +30,9 @@ SOFTWARE.
 namespace
 {
 
-int range_overlap(int x1, int w1, int x2, int w2)
+occupancy_map::area to_area(const board::rect& r)
 {
-    return std::max(std::min(x1 + w1, x2 + w2) - std::max(x1, x2), 0);
-}
-
-int rect_overlap(const board::rect& a, const board::rect& b)
-{
-    return
-        range_overlap(a.x, a.w, b.x, b.w) * range_overlap(a.y, a.h, b.y, b.h);
+    return {r.x, r.y, r.w, r.h};
 }
 
 unsigned hsv_to_rgb(float h, float s, float v)
@@ -79,45 +73,60 @@ unsigned generate_color(int id, bool bounds)
 }
 
 board::board(int w, int h)
-: width(w), height(h), covered(0)
+:   width(w), height(h), covered(0), occupancy(w, h),
+    fill_quads(sf::Quads), outline_quads(sf::Quads), inset_quads(sf::Quads),
+    grid_lines(sf::Lines), label_quads(sf::Quads),
+    label_outline_quads(sf::Quads), label_font(nullptr), label_size(0),
+    labeled_rects(0)
 {
+    build_grid();
 }
 
 void board::resize(int w, int h)
 {
     width = w;
     height = h;
+    occupancy.resize(w, h);
+    build_grid();
 }
 
 void board::reset()
 {
     rects.clear();
     covered = 0;
+    occupancy.clear();
+    fill_quads.clear();
+    outline_quads.clear();
+    inset_quads.clear();
+    label_quads.clear();
+    label_outline_quads.clear();
+    labeled_rects = 0;
 }
 
 void board::place(const rect& r)
 {
     rects.push_back(r);
-    covered += r.w * r.h;
+    covered += r.w * (std::uint64_t)r.h;
+    occupancy.fill(to_area(r));
+    append_rect(r);
 }
 
 bool board::can_place(const rect& r) const
 {
-    // Check bounds
-    if(r.x < 0 || r.y < 0 || r.x + r.w > width || r.y + r.h > height)
-        return false;
+    return occupancy.is_free(to_area(r));
+}
 
-    // Check other rects
-    for(const rect& o: rects)
-    {
-        if(rect_overlap(o, r)) return false;
-    }
-    return true;
+bool board::validate(const std::vector<rect>& layout) const
+{
+    std::vector<occupancy_map::area> areas;
+    areas.reserve(layout.size());
+    for(const rect& r: layout) areas.push_back(to_area(r));
+    return occupancy_map::validate(width, height, areas.data(), areas.size());
 }
 
 double board::coverage() const
 {
-    return covered/(double)(width * height);
+    return covered/((double)width * height);
 }
 
 void board::draw(
@@ -143,100 +152,240 @@ void board::draw(
     for(sf::Vertex& v: bounds) v.color = bounds_color;
     win.draw(bounds, 5, sf::LineStrip);
 
-    // Draw grid if asked to
-    if(draw_grid)
+    // Everything else is stored in board coordinates.
+    sf::Vector2f scale(w/(float)width, h/(float)height);
+    sf::Transform transform = board_transform(x, y, w, h);
+
+    // Outlines are only visible when they end up at least a few pixels wide.
+    bool outlines = std::min(scale.x, scale.y)*outline_width >= 3.0f;
+    if(outlines)
     {
-        for(int gy = 1; gy < height; ++gy)
-        {
-            int sy = y + gy * h / height;
-            sf::Vertex grid_line[] = {
-                sf::Vertex(sf::Vector2f(x, sy), bounds_color),
-                sf::Vertex(sf::Vector2f(x + w, sy), bounds_color),
-            };
-            win.draw(grid_line, 2, sf::Lines);
-        }
+        win.draw(outline_quads, transform);
+        win.draw(inset_quads, transform);
+    }
+    else win.draw(fill_quads, transform);
 
-        for(int gx = 1; gx < width; ++gx)
-        {
-            int sx = x + gx * w / width;
-            sf::Vertex grid_line[] = {
-                sf::Vertex(sf::Vector2f(sx, y), bounds_color),
-                sf::Vertex(sf::Vector2f(sx, y + h), bounds_color),
-            };
-            win.draw(grid_line, 2, sf::Lines);
-        }
+    // Grid is drawn on top, the lines fall on rect edges anyway.
+    if(draw_grid) win.draw(grid_lines, transform);
+
+    if(number_font)
+    {
+        unsigned font_size = std::max(std::min(scale.x, scale.y)*0.5f, 8.0f);
+        update_labels(*number_font, font_size, scale);
+
+        sf::RenderStates states(transform);
+        states.texture = &number_font->getTexture(font_size);
+        win.draw(label_outline_quads, states);
+        win.draw(label_quads, states);
+    }
+}
+
+void board::append_rect(const rect& r)
+{
+    sf::Color color(generate_color(r.id, false));
+    sf::Color outline_color(generate_color(r.id, true));
+    append_quad(fill_quads, r.x, r.y, r.x + r.w, r.y + r.h, color);
+    append_quad(outline_quads, r.x, r.y, r.x + r.w, r.y + r.h, outline_color);
+    append_quad(
+        inset_quads,
+        r.x + outline_width, r.y + outline_width,
+        r.x + r.w - outline_width, r.y + r.h - outline_width,
+        color
+    );
+}
+
+void board::append_quad(
+    sf::VertexArray& quads,
+    float x1, float y1, float x2, float y2,
+    sf::Color color
+){
+    quads.append(sf::Vertex(sf::Vector2f(x1, y1), color));
+    quads.append(sf::Vertex(sf::Vector2f(x2, y1), color));
+    quads.append(sf::Vertex(sf::Vector2f(x2, y2), color));
+    quads.append(sf::Vertex(sf::Vector2f(x1, y2), color));
+}
+
+void board::build_grid()
+{
+    sf::Color grid_color(0x3C3C3CFF);
+    grid_lines.clear();
+    for(int gy = 1; gy < height; ++gy)
+    {
+        grid_lines.append(sf::Vertex(sf::Vector2f(0, gy), grid_color));
+        grid_lines.append(sf::Vertex(sf::Vector2f(width, gy), grid_color));
+    }
+    for(int gx = 1; gx < width; ++gx)
+    {
+        grid_lines.append(sf::Vertex(sf::Vector2f(gx, 0), grid_color));
+        grid_lines.append(sf::Vertex(sf::Vector2f(gx, height), grid_color));
     }
 
-    // Draw rects
-    float outline_thickness = w/(float)width*0.2f;
-    if(outline_thickness < 3.0f) outline_thickness = 0.0f;
-    float font_size = std::max(w/(float)width*0.5f, 8.0f);
-    for(const rect& r: rects)
+    // The label glyphs are sized for the old scale.
+    labeled_rects = 0;
+    label_quads.clear();
+    label_outline_quads.clear();
+}
+
+void board::update_labels(
+    const sf::Font& font, unsigned font_size, sf::Vector2f scale
+) const
+{
+    if(
+        &font != label_font || font_size != label_size ||
+        scale.x != label_scale.x || scale.y != label_scale.y
+    ){
+        label_font = &font;
+        label_size = font_size;
+        label_scale = scale;
+        labeled_rects = 0;
+        label_quads.clear();
+        label_outline_quads.clear();
+    }
+
+    float outline = font_size*0.1f;
+    for(; labeled_rects < rects.size(); ++labeled_rects)
     {
-        sf::Color color(generate_color(r.id, false));
-        sf::Color outline_color(generate_color(r.id, true));
-
-        int fy = height-r.y;
-        int sx1 = x + r.x * w / width;
-        int sy1 = y + fy * h / height+(draw_grid ? 1 : 0);
-        int sx2 = x + (r.x+r.w) * w / width-(draw_grid ? 1 : 0);
-        int sy2 = y + (fy-r.h) * h / height;
-        int sw = sx2-sx1;
-        int sh = sy2-sy1;
-        sf::RectangleShape rs(sf::Vector2f(sw, sh));
-        rs.setPosition(sx1, sy1);
-        rs.setOutlineThickness(-outline_thickness);
-        rs.setFillColor(color);
-        rs.setOutlineColor(outline_color);
-        win.draw(rs);
-
-        if(number_font)
+        const rect& r = rects[labeled_rects];
+        std::string number = std::to_string(r.id);
+
+        // Measure first in pixels, like sf::Text::getLocalBounds().
+        float pen = 0.0f;
+        float left = 0.0f, top = 0.0f, right = 0.0f, bottom = 0.0f;
+        for(size_t i = 0; i < number.size(); ++i)
         {
-            sf::Text number(std::to_string(r.id), *number_font, font_size);
-            number.setOutlineColor(sf::Color::Black);
-            number.setFillColor(sf::Color::White);
-            number.setOutlineThickness(font_size*0.1f);
-            number.setPosition(sf::Vector2f(sx1+sx2, sy1+sy2)*0.5f);
-            sf::FloatRect lb = number.getLocalBounds();
-            number.setOrigin(lb.left + lb.width*0.5f, lb.top + lb.height*0.5f);
-            win.draw(number);
+            if(i > 0) pen += font.getKerning(number[i-1], number[i], font_size);
+            const sf::Glyph& g = font.getGlyph(number[i], font_size, false);
+            float gl = pen + g.bounds.left;
+            float gt = g.bounds.top;
+            float gr = gl + g.bounds.width;
+            float gb = gt + g.bounds.height;
+            if(i == 0)
+            {
+                left = gl; top = gt; right = gr; bottom = gb;
+            }
+            else
+            {
+                left = std::min(left, gl);
+                top = std::min(top, gt);
+                right = std::max(right, gr);
+                bottom = std::max(bottom, gb);
+            }
+            pen += g.advance;
+        }
+
+        // Pixel offsets from the label center are scaled back into board
+        // units, flipping y since glyph metrics grow downwards.
+        sf::Vector2f center(r.x + r.w*0.5f, r.y + r.h*0.5f);
+        float ox = -(left + right)*0.5f;
+        float oy = -(top + bottom)*0.5f;
+        auto append_glyph = [&](
+            sf::VertexArray& quads, const sf::Glyph& g, float gx, sf::Color c
+        ){
+            float x1 = center.x + (ox + gx + g.bounds.left)/scale.x;
+            float x2 = x1 + g.bounds.width/scale.x;
+            float y1 = center.y - (oy + g.bounds.top)/scale.y;
+            float y2 = y1 - g.bounds.height/scale.y;
+            float u1 = g.textureRect.left;
+            float v1 = g.textureRect.top;
+            float u2 = u1 + g.textureRect.width;
+            float v2 = v1 + g.textureRect.height;
+            quads.append(sf::Vertex({x1, y1}, c, {u1, v1}));
+            quads.append(sf::Vertex({x2, y1}, c, {u2, v1}));
+            quads.append(sf::Vertex({x2, y2}, c, {u2, v2}));
+            quads.append(sf::Vertex({x1, y2}, c, {u1, v2}));
+        };
+
+        pen = 0.0f;
+        for(size_t i = 0; i < number.size(); ++i)
+        {
+            if(i > 0) pen += font.getKerning(number[i-1], number[i], font_size);
+            append_glyph(
+                label_outline_quads,
+                font.getGlyph(number[i], font_size, false, outline),
+                pen, sf::Color::Black
+            );
+            const sf::Glyph& g = font.getGlyph(number[i], font_size, false);
+            append_glyph(label_quads, g, pen, sf::Color::White);
+            pen += g.advance;
         }
     }
 }
 
-/*
 void board::draw_debug_edges(
     sf::RenderWindow& win,
-    rect_packer& pack,
+    const rect_packer& pack,
     int x, int y,
     int w, int h
 ) const
 {
-    // Draw bounds
     sf::Color ur_color(0x00FF00FF);
     sf::Color bu_color(0xFF0000FF);
 
-    for(auto& edge: pack.edges)
+    sf::VertexArray lines(sf::Lines);
+    for(size_t i = 0; i < pack.get_edge_count(); ++i)
     {
+        rect_packer::edge_info edge = pack.get_edge(i);
         sf::Color col = edge.up_right_inside ? ur_color : bu_color;
-        int x1 = edge.x;
-        int y1 = edge.y;
         int x2 = edge.vertical ? edge.x : edge.x + edge.length;
         int y2 = edge.vertical ? edge.y + edge.length : edge.y;
+        lines.append(sf::Vertex(sf::Vector2f(edge.x, edge.y), col));
+        lines.append(sf::Vertex(sf::Vector2f(x2, y2), col));
+    }
+    win.draw(lines, board_transform(x, y, w, h));
+}
 
-        y1 = height - y1;
-        y2 = height - y2;
+void board::draw_heatmap(
+    sf::RenderWindow& win,
+    const rect_packer& pack,
+    int x, int y,
+    int w, int h,
+    bool visits
+) const
+{
+    int cell_size = pack.get_lookup_cell_size();
+    int lookup_w = pack.get_lookup_width();
+    int lookup_h = pack.get_lookup_height();
 
-        x1 = x + x1 * w / width;
-        y1 = y + y1 * h / height;
-        x2 = x + x2 * w / width;
-        y2 = y + y2 * h / height;
+    std::vector<double> heat(lookup_w * lookup_h);
+    double max_heat = 0;
+    for(int cy = 0; cy < lookup_h; ++cy)
+    for(int cx = 0; cx < lookup_w; ++cx)
+    {
+        double v = visits ?
+            pack.get_cell_visits(cx, cy) : pack.get_cell_edge_count(cx, cy);
+        // Visit counts span orders of magnitude, so they're shown on a log
+        // scale.
+        if(visits) v = log1p(v);
+        heat[cy * lookup_w + cx] = v;
+        max_heat = std::max(max_heat, v);
+    }
+    if(max_heat == 0) return;
 
-        sf::Vertex grid_line[] = {
-            sf::Vertex(sf::Vector2f(x1, y1), col),
-            sf::Vertex(sf::Vector2f(x2, y2), col),
-        };
-        win.draw(grid_line, 2, sf::Lines);
+    // Cold cells are blue and transparent, hot ones red and opaque.
+    sf::VertexArray quads(sf::Quads);
+    for(int cy = 0; cy < lookup_h; ++cy)
+    for(int cx = 0; cx < lookup_w; ++cx)
+    {
+        double t = heat[cy * lookup_w + cx] / max_heat;
+        if(t == 0) continue;
+        sf::Color color(hsv_to_rgb(240 * (1 - t), 1, 1));
+        color.a = 64 + 128 * t;
+        append_quad(
+            quads,
+            cx * cell_size, cy * cell_size,
+            std::min((cx + 1) * cell_size, width),
+            std::min((cy + 1) * cell_size, height),
+            color
+        );
     }
+    win.draw(quads, board_transform(x, y, w, h));
+}
+
+sf::Transform board::board_transform(int x, int y, int w, int h) const
+{
+    // Board coordinates have y up, screen coordinates down.
+    sf::Transform transform;
+    transform.translate(x, y + h);
+    transform.scale(w/(float)width, -h/(float)height);
+    return transform;
 }
-*/
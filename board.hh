@@ -24,9 +24,11 @@ SOFTWARE.
 #ifndef RECT_PACKER_BOARD_HH
 #define RECT_PACKER_BOARD_HH
 #include <SFML/Graphics.hpp>
+#include <cstdint>
 #include <vector>
+#include "rect_packer.hh"
+#include "occupancy.hh"
 
-class rect_packer;
 class board
 {
 public:
@@ -44,6 +46,9 @@ public:
 
     void place(const rect& r);
     bool can_place(const rect& r) const;
+    // Checks that the given rects fit on an empty board of this size without
+    // overlapping. Doesn't consider rects already placed on the board.
+    bool validate(const std::vector<rect>& layout) const;
     double coverage() const;
 
     void draw(
@@ -54,16 +59,60 @@ public:
         sf::Font* number_font
     ) const;
 
+    // Draws the packer's free edges over the board. Green edges have free
+    // space up or right of them, red ones down or left.
     void draw_debug_edges(
         sf::RenderWindow& win,
-        rect_packer& pack,
+        const rect_packer& pack,
         int x, int y,
         int w, int h
     ) const;
+
+    // Draws the packer's lookup cells as a heatmap over the board. With
+    // visits, the heat is the number of times each cell was scanned while
+    // scoring (see rect_packer::set_count_visits()), otherwise it's the number
+    // of edges in the cell.
+    void draw_heatmap(
+        sf::RenderWindow& win,
+        const rect_packer& pack,
+        int x, int y,
+        int w, int h,
+        bool visits
+    ) const;
 private:
+    void append_rect(const rect& r);
+    static void append_quad(
+        sf::VertexArray& quads,
+        float x1, float y1, float x2, float y2,
+        sf::Color color
+    );
+    void build_grid();
+    sf::Transform board_transform(int x, int y, int w, int h) const;
+    void update_labels(
+        const sf::Font& font, unsigned font_size, sf::Vector2f scale
+    ) const;
+
     int width, height;
-    int covered;
+    std::uint64_t covered;
     std::vector<rect> rects;
+    occupancy_map occupancy;
+
+    // Drawing data is kept in board coordinates and appended to as rects are
+    // placed, so that draw() only issues a handful of draw calls.
+    static constexpr float outline_width = 0.2f;
+    sf::VertexArray fill_quads;
+    sf::VertexArray outline_quads;
+    sf::VertexArray inset_quads;
+    sf::VertexArray grid_lines;
+
+    // Labels depend on the font size, so they are built lazily in draw() and
+    // rebuilt whenever the size changes.
+    mutable sf::VertexArray label_quads;
+    mutable sf::VertexArray label_outline_quads;
+    mutable const sf::Font* label_font;
+    mutable unsigned label_size;
+    mutable sf::Vector2f label_scale;
+    mutable size_t labeled_rects;
 };
 
 #endif
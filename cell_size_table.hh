@@ -0,0 +1,64 @@
+// Generated by patm-autotune (autotune.cc), don't edit by hand.
+// Measured areas 2^10-2^22, mean rect sizes 2^1-2^7, 0.05 s per
+// candidate, canvas to rect size ratios up to 96.
+#ifndef RECT_PACKER_CELL_SIZE_TABLE_HH
+#define RECT_PACKER_CELL_SIZE_TABLE_HH
+#include <cstdint>
+
+// Row i is for canvas areas in [2^i, 2^(i+1)), column j for mean
+// rect sizes ((w+h)/2) in [2^j, 2^(j+1)).
+constexpr int cell_size_table_rows = 41;
+constexpr int cell_size_table_cols = 12;
+// Used until the packer has seen any rects.
+constexpr int cell_size_table_default_col = 3;
+
+constexpr std::uint16_t cell_size_table[41][12] = {
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 5, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 5, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {3, 6, 5, 8, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 4, 6, 10, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 6, 10, 16, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 6, 10, 20, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 3, 10, 20, 32, 64, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 20, 40, 64, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 20, 40, 64, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 20, 40, 64, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128},
+    {2, 3, 3, 8, 32, 32, 128, 128, 128, 128, 128, 128}
+};
+
+// Identifies this table. Automatic cell sizes can change the
+// placements slightly, so results stored elsewhere should be keyed
+// by this.
+constexpr std::uint32_t cell_size_table_id = 0x757ef9d7;
+
+#endif
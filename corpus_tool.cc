@@ -0,0 +1,265 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// patm-corpus: writes the reference rect corpora (see rect_corpus.hh) and
+// prints what's in corpus files. The reference sets are generated from fixed
+// seeds, mimicking three common kinds of atlases:
+//
+//   glyphs.patr     Latin fonts at several sizes and CJK pages, 1024x1024
+//   lightmaps.patr  Lightmap charts of varying size and aspect, 4096x4096
+//   sprites.patr    Animations with runs of equal-sized frames, 2048x2048
+//
+// Each one fills its canvas about as full as a real atlas would get: rects
+// are added until they cover 90% of it, ending the last group early.
+// Regenerate them with:
+//
+//   patm-corpus -o corpora
+#include "rect_corpus.hh"
+#include "rect_sets.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct corpus_builder
+{
+    int w, h;
+    std::vector<rect_corpus::record> records;
+    std::vector<std::uint32_t> group_ends;
+    std::uint64_t area = 0;
+
+    bool full(double fill) const
+    {
+        return area >= fill * w * h;
+    }
+
+    void add(int rw, int rh, std::uint32_t flags)
+    {
+        records.push_back({
+            std::uint16_t(rw), std::uint16_t(rh), flags
+        });
+        area += rw * std::uint64_t(rh);
+    }
+
+    void end_group()
+    {
+        if(group_ends.empty() || group_ends.back() != records.size())
+            group_ends.push_back(records.size());
+    }
+
+    bool write(const std::string& path) const
+    {
+        return rect_corpus::write(
+            path.c_str(), w, h, records.data(), records.size(),
+            group_ends.data(), group_ends.size()
+        );
+    }
+};
+
+// One group per font size, then pages of CJK glyphs until the atlas is full.
+// The flags are the glyph index within its font.
+corpus_builder make_glyphs(unsigned seed)
+{
+    corpus_builder b = {1024, 1024, {}, {}, 0};
+    for(int size: {12, 16, 20, 24, 32, 48})
+    {
+        float s = size;
+        glyph_generator gen({s*0.6f, s*0.2f, s, s*0.15f, 100, 10}, seed++);
+        std::vector<rect_packer::rect> group = gen.next_group();
+        for(size_t i = 0; i < group.size(); ++i)
+            b.add(group[i].w, group[i].h, i);
+        b.end_group();
+    }
+
+    glyph_generator cjk({24, 2, 24, 2, 400, 50}, seed);
+    for(std::uint32_t index = 0; !b.full(0.9);)
+    {
+        for(const rect_packer::rect& r: cjk.next_group())
+        {
+            if(b.full(0.9)) break;
+            b.add(r.w, r.h, index++);
+        }
+        b.end_group();
+    }
+    return b;
+}
+
+// Charts are 4-256 texels per side, log-uniformly, with aspect ratios up to
+// 4:1. Each group is a chunk of a level with 50-200 charts; the flags are the
+// mesh the chart belongs to.
+corpus_builder make_lightmaps(unsigned seed)
+{
+    corpus_builder b = {4096, 4096, {}, {}, 0};
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> log_size(2, 8);
+    std::uniform_real_distribution<float> log_aspect(-2, 2);
+    std::uniform_int_distribution<int> chunk_size(50, 200);
+    std::uniform_int_distribution<int> charts_per_mesh(1, 8);
+
+    for(std::uint32_t mesh = 0; !b.full(0.9);)
+    {
+        for(int i = chunk_size(rng); i > 0 && !b.full(0.9);)
+        {
+            for(
+                int j = charts_per_mesh(rng);
+                j > 0 && i > 0 && !b.full(0.9);
+                --j, --i
+            ){
+                float size = std::pow(2.0f, log_size(rng));
+                float aspect = std::pow(2.0f, log_aspect(rng) / 2);
+                int w = std::max((int)std::lround(size * aspect), 1);
+                int h = std::max((int)std::lround(size / aspect), 1);
+                b.add(std::min(w, 256), std::min(h, 256), mesh);
+            }
+            mesh++;
+        }
+        b.end_group();
+    }
+    return b;
+}
+
+// Each group is a character with 3-10 animations of 4-24 frames. All frames
+// of an animation have the same size, 16-128 pixels per side in steps of 4.
+// The flags are the animation index.
+corpus_builder make_sprites(unsigned seed)
+{
+    corpus_builder b = {2048, 2048, {}, {}, 0};
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> animations(3, 10);
+    std::uniform_int_distribution<int> frames(4, 24);
+    std::uniform_int_distribution<int> frame_size(4, 32);
+
+    for(std::uint32_t animation = 0; !b.full(0.9);)
+    {
+        for(int i = animations(rng); i > 0 && !b.full(0.9); --i, ++animation)
+        {
+            int w = frame_size(rng) * 4, h = frame_size(rng) * 4;
+            for(int j = frames(rng); j > 0 && !b.full(0.9); --j)
+                b.add(w, h, animation);
+        }
+        b.end_group();
+    }
+    return b;
+}
+
+bool print_info(const char* path)
+{
+    rect_corpus corpus;
+    if(!corpus.open(path))
+    {
+        fprintf(stderr, "%s is not a valid rect corpus\n", path);
+        return false;
+    }
+
+    std::uint64_t area = 0;
+    const rect_corpus::record* records = corpus.get_records();
+    for(size_t i = 0; i < corpus.get_rect_count(); ++i)
+        area += records[i].w * std::uint64_t(records[i].h);
+    printf(
+        "%s: %zu rects in %zu groups, canvas %dx%d, area %.1f%% of canvas%s\n",
+        path, corpus.get_rect_count(), corpus.get_group_count(),
+        corpus.get_canvas_w(), corpus.get_canvas_h(),
+        100.0 * area / (corpus.get_canvas_w() * (double)corpus.get_canvas_h()),
+        corpus.is_mapped() ? ", mapped" : ""
+    );
+    return true;
+}
+
+void print_usage(const char* program)
+{
+    fprintf(
+        stderr,
+        "Usage: %s -o DIR [--seed N]\n"
+        "       %s --info FILE...\n"
+        "  -o DIR      Write the reference corpora to DIR\n"
+        "  --seed N    Seed of the generated sets (0)\n"
+        "  --info      Print the size and groups of corpus files\n",
+        program, program
+    );
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const char* output = nullptr;
+    unsigned seed = 0;
+    bool info = false;
+    std::vector<const char*> files;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+        if(!strcmp(argv[i], "-o") && has_value)
+            output = argv[++i];
+        else if(!strcmp(argv[i], "--seed") && has_value)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if(!strcmp(argv[i], "--info"))
+            info = true;
+        else if(info && argv[i][0] != '-')
+            files.push_back(argv[i]);
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(info)
+    {
+        bool ok = !files.empty();
+        for(const char* path: files) ok = print_info(path) && ok;
+        return ok ? 0 : 1;
+    }
+    if(!output)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    struct named_corpus { const char* name; corpus_builder corpus; };
+    named_corpus corpora[] = {
+        {"glyphs.patr", make_glyphs(seed)},
+        {"lightmaps.patr", make_lightmaps(seed)},
+        {"sprites.patr", make_sprites(seed)}
+    };
+    for(const named_corpus& c: corpora)
+    {
+        std::string path = std::string(output) + "/" + c.name;
+        if(!c.corpus.write(path))
+        {
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+            return 1;
+        }
+        print_info(path.c_str());
+    }
+    return 0;
+}
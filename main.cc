@@ -23,13 +23,14 @@ SOFTWARE.
 */
 #include "rect_packer.hh"
 #include "board.hh"
-#define STB_RECT_PACK_IMPLEMENTATION
+#include "rect_sets.hh"
 #include "stb_rect_pack.h"
 #include <SFML/Graphics.hpp>
 #include <cstdio>
 #include <memory>
 #include <random>
 #include <algorithm>
+#include <stdexcept>
 #include <ctime>
 
 static int initial_seed = time(nullptr);
@@ -41,69 +42,17 @@ void shuffle(std::vector<T>& v)
     std::shuffle(v.begin(), v.end(), rng);
 }
 
-std::vector<board::rect> generate_guillotine_set(
+std::vector<board::rect> generate_guillotine_board(
     int w, int h, unsigned splits, bool quiet = false
 ){
     if(!quiet)
         printf("Generating guillotine set for seed %d\n", initial_seed);
-    std::mt19937 rng(initial_seed++);
-    std::uniform_int_distribution<> bdis(0,1);
-
-    struct node
-    {
-        int w, h;
-        bool vertical;
-        std::vector<node> children;
-
-        bool atomic()
-        {
-            return (vertical && w == 1) || (!vertical && h == 1);
-        }
-
-        bool split(std::mt19937& rng)
-        {
-            if(atomic()) return false;
-            if(children.size())
-            {
-                std::uniform_int_distribution<> bdis(0,1);
-                int first = bdis(rng);
-                int second = first^1;
-                return children[first].split(rng) || children[second].split(rng);
-            }
-
-            if(vertical)
-            {
-                std::uniform_int_distribution<> wdis(1,w-1);
-                int split = wdis(rng);
-                children.push_back({split, h, false,{}});
-                children.push_back({w-split, h, false,{}});
-            }
-            else
-            {
-                std::uniform_int_distribution<> hdis(1,h-1);
-                int split = hdis(rng);
-                children.push_back({w, split, true,{}});
-                children.push_back({w, h-split, true,{}});
-            }
-            return true;
-        }
-
-        void traverse(int x, int y, std::vector<board::rect>& rects)
-        {
-            if(children.empty())
-                rects.push_back({(int)rects.size(), x, y, w, h});
-            else for(node& child: children)
-            {
-                child.traverse(x, y, rects);
-                if(vertical) x += child.w;
-                else y += child.h;
-            }
-        }
-    };
-    node root{w, h, bdis(rng), {}};
-    for(unsigned i = 0; i < splits; ++i) root.split(rng);
+    std::vector<rect_packer::rect> set = generate_guillotine_set(
+        w, h, splits, initial_seed++
+    );
     std::vector<board::rect> rects;
-    root.traverse(0, 0, rects);
+    for(const rect_packer::rect& r: set)
+        rects.push_back({(int)rects.size(), r.x, r.y, r.w, r.h});
     return rects;
 }
 
@@ -132,7 +81,7 @@ void measure_rate(
         pack_board.reset();
         packer.reset();
 
-        rects = generate_guillotine_set(w, h, splits, true);
+        rects = generate_guillotine_board(w, h, splits, true);
         shuffle(rects);
 
         unsigned count = 0;
@@ -203,96 +152,6 @@ void measure_rate(
     printf("Time per rect^2: %f\n", 1e10*time/pow((double)total_count, 2));
 }
 
-int search_optimal_tile_size(
-    int w,
-    int h,
-    unsigned splits,
-    float time_limit,
-    const std::vector<unsigned>& sizes,
-    bool at_once,
-    bool allow_rotation,
-    bool quiet = false
-){
-    rect_packer packer(w, h, false);
-    std::vector<board::rect> rects;
-    std::vector<rect_packer::rect> rects_queue;
-
-    sf::Clock clock;
-    sf::Time limit(sf::seconds(time_limit));
-
-    float best_finishes = 0;
-    unsigned best_size = 0;
-
-    if(!quiet) printf("Cell size search for %d, %d.\n", w, h);
-    for(unsigned cell_size: sizes)
-    {
-        float finishes = 0;
-        sf::Time total_time;
-
-        packer.set_cell_size(cell_size);
-
-        if(!quiet)
-        {
-            printf("Size %u: ", cell_size);
-            fflush(stdout);
-        }
-        
-        initial_seed = 0;
-        while(total_time < limit)
-        {
-            packer.reset();
-
-            rects = generate_guillotine_set(w, h, splits, true);
-            shuffle(rects);
-
-            sf::Time elapsed;
-            if(at_once)
-            {
-                rects_queue.clear();
-                rects_queue.reserve(rects.size());
-                for(unsigned i = 0; i < rects.size(); ++i)
-                    rects_queue.push_back({rects[i].w, rects[i].h});
-                clock.restart();
-                packer.pack(
-                    rects_queue.data(),
-                    rects_queue.size(),
-                    allow_rotation
-                );
-                elapsed = clock.getElapsedTime();
-            }
-            else
-            {
-                clock.restart();
-                for(board::rect& r: rects)
-                {
-                    if(allow_rotation)
-                    {
-                        bool rotated = false;
-                        packer.pack_rotate(r.w,r.h,r.x,r.y,rotated);
-                    }
-                    else packer.pack(r.w,r.h,r.x,r.y);
-                }
-                elapsed = clock.getElapsedTime();
-            }
-
-            if(total_time + elapsed < limit)
-                finishes += 1.0f;
-            else
-                finishes += (limit - total_time) / elapsed;
-            total_time += elapsed;
-        }
-
-        if(finishes >= best_finishes)
-        {
-            best_finishes = finishes;
-            best_size = cell_size;
-        }
-        if(!quiet) printf("%f\n", finishes);
-    }
-    if(!quiet) printf("Best cell size for %d, %d: %u\n", w, h, best_size);
-    return best_size;
-}
-
 void glyph_test(
     float w_mean, float w_stddev,
     float h_mean, float h_stddev,
@@ -301,10 +160,9 @@ void glyph_test(
     unsigned canvas_h,
     unsigned seed = 0
 ){
-    std::mt19937 rng(seed);
-    std::normal_distribution<float> w_dist(w_mean, w_stddev);
-    std::normal_distribution<float> h_dist(h_mean, h_stddev);
-    std::normal_distribution<float> g_dist(g_mean, g_stddev);
+    glyph_generator gen(
+        {w_mean, w_stddev, h_mean, h_stddev, g_mean, g_stddev}, seed
+    );
 
     rect_packer packer(canvas_w, canvas_h, false);
     std::vector<rect_packer::rect> my_rects;
@@ -325,17 +183,13 @@ void glyph_test(
     printf("Start packing! (w: %f, h: %f, g: %f)\n", w_mean, h_mean, g_mean);
     while(!my_full || !stb_full)
     {
-        my_rects.clear();
+        my_rects = gen.next_group();
         stb_rects.clear();
-        int group_size = round(g_dist(rng));
-        if(group_size < 0) continue;
-        for(int i = 0; i < group_size; ++i)
+        int group_size = my_rects.size();
+        for(const rect_packer::rect& r: my_rects)
         {
-            int w = std::max((int)round(w_dist(rng)), 1);
-            int h = std::max((int)round(h_dist(rng)), 1);
-            my_rects.push_back({w, h});
             stb_rects.push_back(
-                {0, (short unsigned)w, (short unsigned)h, 0, 0, 0}
+                {0, (short unsigned)r.w, (short unsigned)r.h, 0, 0, 0}
             );
         }
 
@@ -385,38 +239,19 @@ int main()
     */
     glyph_test(50, 15, 80, 15, 2000, 0, 1024, 1024, time(nullptr));
 
-    /*
-    int prev_optimal = 1;
-    std::vector<std::pair<int, int>> results;
-    for(int i = 1; i <= 24; ++i)
-    {
-        int n = 1<<(i>>1);
-        if((i&1) == 1) n += n >> 1;
-
-        std::vector<unsigned> candidates;
-        for(int j = prev_optimal-3; j < prev_optimal + 6; ++j)
-        {
-            if(j < 1 || j > n) continue;
-            candidates.push_back(j);
-        }
-        int optimal = search_optimal_tile_size(
-            n, n, n*2, 2.0f, candidates, true, true, false
-        );
-        prev_optimal = optimal;
-        results.push_back({n,optimal});
-    }
-
-    for(auto [n, cell]: results)
-        printf("%d;%d\n", n, cell);
-    return 0;
-    */
-
     board pack_board(w, h);
     board orig_board(w, h);
     rect_packer packer(w, h, false);
+    packer.set_count_visits(true);
     int pack_index = 0;
     int packed = 0;
 
+    // Cycled with H: 0 is off, then edges, edges per cell and cell visits.
+    int overlay = 0;
+    const char* overlay_names[] = {
+        "none", "free edges", "edges per cell", "cell visits"
+    };
+
     std::vector<board::rect> rects;
     std::vector<rect_packer::rect> rects_queue;
 
@@ -428,7 +263,7 @@ int main()
         pack_index = 0;
         packed = 0;
 
-        rects = generate_guillotine_set(w, h, splits);
+        rects = generate_guillotine_board(w, h, splits);
         shuffle(rects);
 
         if(at_once)
@@ -535,6 +370,11 @@ int main()
                     pack_board.resize(w, h);
                     packer.enlarge(w, h);
                 }
+                if(event.key.code == sf::Keyboard::H)
+                {
+                    overlay = (overlay + 1) % 4;
+                    printf("Overlay: %s\n", overlay_names[overlay]);
+                }
             }
         }
 
@@ -561,9 +401,14 @@ int main()
         sf::Vector2u sz = window.getSize();
         //pack_board.draw(window, 10, 10, sz.x/2-20, sz.y-20, true, &font);
         //orig_board.draw(window, sz.x/2+10, 10, sz.x/2-20, sz.y-20, true, &font);
-        //pack_board.draw_debug_edges(window, packer, 10, 10, sz.x/2-20, sz.y-20);
         pack_board.draw(window, 10, 10, sz.x/2-20, sz.y-20, false, nullptr);
         orig_board.draw(window, sz.x/2+10, 10, sz.x/2-20, sz.y-20, false, nullptr);
+        if(overlay == 1)
+            pack_board.draw_debug_edges(window, packer, 10, 10, sz.x/2-20, sz.y-20);
+        else if(overlay > 1)
+            pack_board.draw_heatmap(
+                window, packer, 10, 10, sz.x/2-20, sz.y-20, overlay == 3
+            );
 
         if(pack_index >= (int)rects.size())
         {
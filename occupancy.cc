@@ -0,0 +1,199 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "occupancy.hh"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace
+{
+
+// Bits [lo, hi) of a word, 0 <= lo < hi <= 64.
+std::uint64_t span_mask(int lo, int hi)
+{
+    std::uint64_t upper = hi == 64 ? ~std::uint64_t(0) :
+        (std::uint64_t(1) << hi) - 1;
+    return upper & ~((std::uint64_t(1) << lo) - 1);
+}
+
+// Returns false if any of the bits of [x, x+w) in the row are set.
+bool test(const std::uint64_t* row, int x, int w)
+{
+    int first = x >> 6;
+    int last = (x + w - 1) >> 6;
+    for(int i = first; i <= last; ++i)
+    {
+        std::uint64_t mask = span_mask(
+            std::max(x - i * 64, 0), std::min(x + w - i * 64, 64)
+        );
+        if(row[i] & mask) return false;
+    }
+    return true;
+}
+
+// Sets the bits of [x, x+w) in the row, and returns false if any of them were
+// already set.
+bool test_and_set(std::uint64_t* row, int x, int w)
+{
+    int first = x >> 6;
+    int last = (x + w - 1) >> 6;
+    bool free = true;
+    for(int i = first; i <= last; ++i)
+    {
+        std::uint64_t mask = span_mask(
+            std::max(x - i * 64, 0), std::min(x + w - i * 64, 64)
+        );
+        if(row[i] & mask) free = false;
+        row[i] |= mask;
+    }
+    return free;
+}
+
+bool in_bounds(int w, int h, const occupancy_map::area& a)
+{
+    return a.x >= 0 && a.y >= 0 && a.w > 0 && a.h > 0 &&
+        a.x + a.w <= w && a.y + a.h <= h;
+}
+
+}
+
+occupancy_map::occupancy_map(int w, int h)
+: width(0), height(0), words_per_row(0)
+{
+    resize(w, h);
+}
+
+void occupancy_map::resize(int w, int h)
+{
+    int new_words_per_row = (w + 63) / 64;
+    std::vector<std::uint64_t> new_bits(new_words_per_row * (size_t)h, 0);
+
+    int copy_words = std::min(words_per_row, new_words_per_row);
+    int copy_rows = std::min(height, h);
+    for(int y = 0; y < copy_rows; ++y)
+    {
+        std::copy(
+            bits.begin() + y * (size_t)words_per_row,
+            bits.begin() + y * (size_t)words_per_row + copy_words,
+            new_bits.begin() + y * (size_t)new_words_per_row
+        );
+    }
+
+    // Drop bits past the new width when shrinking.
+    if(w < width && w % 64 != 0)
+    {
+        std::uint64_t keep = span_mask(0, w % 64);
+        for(int y = 0; y < copy_rows; ++y)
+            new_bits[y * (size_t)new_words_per_row + w / 64] &= keep;
+    }
+
+    width = w;
+    height = h;
+    words_per_row = new_words_per_row;
+    bits.swap(new_bits);
+}
+
+void occupancy_map::clear()
+{
+    std::fill(bits.begin(), bits.end(), 0);
+}
+
+bool occupancy_map::is_free(const area& a) const
+{
+    if(!in_bounds(width, height, a)) return false;
+
+    for(int y = a.y; y < a.y + a.h; ++y)
+        if(!test(bits.data() + y * (size_t)words_per_row, a.x, a.w))
+            return false;
+    return true;
+}
+
+void occupancy_map::fill(const area& a)
+{
+    int x0 = std::max(a.x, 0);
+    int x1 = std::min(a.x + a.w, width);
+    int y0 = std::max(a.y, 0);
+    int y1 = std::min(a.y + a.h, height);
+    if(x0 >= x1) return;
+
+    for(int y = y0; y < y1; ++y)
+        test_and_set(bits.data() + y * (size_t)words_per_row, x0, x1 - x0);
+}
+
+bool occupancy_map::validate(
+    int w, int h, const area* areas, size_t count, unsigned threads
+){
+    for(size_t i = 0; i < count; ++i)
+        if(!in_bounds(w, h, areas[i])) return false;
+
+    if(threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    threads = std::max(std::min<unsigned>(threads, h), 1u);
+
+    // Each thread owns a band of rows, so they never write to the same words.
+    // The areas are listed per band first, so that a thread only goes through
+    // the ones that reach its rows.
+    std::vector<int> band_start(threads + 1);
+    for(unsigned i = 0; i <= threads; ++i) band_start[i] = h * i / threads;
+    std::vector<std::vector<size_t>> band_areas(threads);
+    for(size_t i = 0; i < count; ++i)
+    {
+        const area& a = areas[i];
+        unsigned first = std::upper_bound(
+            band_start.begin(), band_start.end(), a.y
+        ) - band_start.begin() - 1;
+        for(unsigned b = first; b < threads && band_start[b] < a.y + a.h; ++b)
+            band_areas[b].push_back(i);
+    }
+
+    std::atomic<bool> valid(true);
+    int words_per_row = (w + 63) / 64;
+    auto check_band = [&](unsigned b){
+        int y0 = band_start[b], y1 = band_start[b + 1];
+        std::vector<std::uint64_t> band(words_per_row * (size_t)(y1 - y0), 0);
+        for(size_t i: band_areas[b])
+        {
+            if(!valid) break;
+            const area& a = areas[i];
+            int ay0 = std::max(a.y, y0);
+            int ay1 = std::min(a.y + a.h, y1);
+            for(int y = ay0; y < ay1; ++y)
+            {
+                std::uint64_t* row =
+                    band.data() + (y - y0) * (size_t)words_per_row;
+                if(!test_and_set(row, a.x, a.w))
+                {
+                    valid = false;
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < threads; ++i) pool.emplace_back(check_band, i);
+    check_band(0);
+    for(std::thread& t: pool) t.join();
+    return valid;
+}
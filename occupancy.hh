@@ -0,0 +1,67 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_OCCUPANCY_HH
+#define RECT_PACKER_OCCUPANCY_HH
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A bitmap of occupied pixels, one bit per pixel and 64 pixels per word.
+// Testing or filling a rect touches h*(w/64) words instead of comparing
+// against every previously placed rect, so checking a whole layout is roughly
+// linear in its area instead of quadratic in its rect count.
+class occupancy_map
+{
+public:
+    struct area
+    {
+        int x, y, w, h;
+    };
+
+    occupancy_map(int w = 0, int h = 0);
+
+    // Changes the size, keeping whatever fits of the current contents.
+    void resize(int w, int h);
+    void clear();
+
+    // False if the area is out of bounds or overlaps a filled one.
+    bool is_free(const area& a) const;
+
+    // Doesn't check anything, use is_free() first if needed.
+    void fill(const area& a);
+
+    // Checks that none of the areas overlap each other or go out of w*h
+    // bounds. Rows are split evenly between 'threads' threads, 0 means one
+    // per core.
+    static bool validate(
+        int w, int h, const area* areas, size_t count, unsigned threads = 0
+    );
+
+private:
+    int width, height;
+    int words_per_row;
+    std::vector<std::uint64_t> bits;
+};
+
+#endif
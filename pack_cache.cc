@@ -0,0 +1,286 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "pack_cache.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // An entry is the magic, format version, the key and then the canvas size
+    // and x, y, flags for each rect, all as little-endian 32-bit words.
+    const char entry_magic[4] = {'P', 'A', 'T', 'C'};
+    const std::uint32_t entry_version = 2;
+    const char entry_extension[] = ".patc";
+    // Entries are written to "<entry>.tmp<pid>-<n>" first. One that is this
+    // old was left behind by a process that died while writing it.
+    const char temp_marker[] = ".patc.tmp";
+    const std::chrono::hours stale_temp_age(1);
+
+    void put_u32(std::vector<unsigned char>& data, std::uint32_t value)
+    {
+        data.push_back(value);
+        data.push_back(value >> 8);
+        data.push_back(value >> 16);
+        data.push_back(value >> 24);
+    }
+
+    std::uint32_t get_u32(const unsigned char* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) |
+            ((std::uint32_t)data[3] << 24);
+    }
+
+    std::uint64_t fnv1a(const std::vector<std::uint32_t>& words)
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for(std::uint32_t word: words)
+        for(int i = 0; i < 4; ++i)
+        {
+            hash ^= (word >> (i * 8)) & 0xFF;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    bool read_file(const std::string& path, std::vector<unsigned char>& data)
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        if(!f) return false;
+        data.clear();
+        unsigned char buf[65536];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+            data.insert(data.end(), buf, buf + n);
+        bool ok = !ferror(f);
+        fclose(f);
+        return ok;
+    }
+}
+
+pack_cache::pack_cache(const std::string& dir, std::uint64_t max_bytes)
+: dir(dir), max_bytes(max_bytes), total_bytes(0), hits(0), misses(0)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    total_bytes = evict(max_bytes / 4 * 3);
+}
+
+bool pack_cache::load(
+    const settings& s, rect_packer::rect* rects, size_t count,
+    int& canvas_w, int& canvas_h
+){
+    std::vector<std::uint32_t> key;
+    make_key(s, rects, count, key);
+    std::string path = entry_path(key);
+
+    std::vector<unsigned char> data;
+    size_t header = 8 + key.size() * 4;
+    bool hit = read_file(path, data) &&
+        data.size() == header + 8 + count * 12 &&
+        !memcmp(data.data(), entry_magic, 4) &&
+        get_u32(&data[4]) == entry_version;
+    for(size_t i = 0; hit && i < key.size(); ++i)
+        hit = get_u32(&data[8 + i * 4]) == key[i];
+
+    if(!hit)
+    {
+        misses++;
+        return false;
+    }
+
+    const unsigned char* p = data.data() + header;
+    canvas_w = get_u32(p);
+    canvas_h = get_u32(p + 4);
+    p += 8;
+    for(size_t i = 0; i < count; ++i, p += 12)
+    {
+        rects[i].x = get_u32(p);
+        rects[i].y = get_u32(p + 4);
+        std::uint32_t flags = get_u32(p + 8);
+        rects[i].packed = flags & 1;
+        rects[i].rotated = flags & 2;
+    }
+
+    // Marks the entry as recently used for evict().
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    hits++;
+    return true;
+}
+
+bool pack_cache::store(
+    const settings& s, const rect_packer::rect* rects, size_t count,
+    int canvas_w, int canvas_h
+){
+    std::vector<std::uint32_t> key;
+    make_key(s, rects, count, key);
+    std::string path = entry_path(key);
+
+    std::vector<unsigned char> data(entry_magic, entry_magic + 4);
+    data.reserve(8 + key.size() * 4 + 8 + count * 12);
+    put_u32(data, entry_version);
+    for(std::uint32_t word: key) put_u32(data, word);
+    put_u32(data, canvas_w);
+    put_u32(data, canvas_h);
+    for(size_t i = 0; i < count; ++i)
+    {
+        put_u32(data, rects[i].x);
+        put_u32(data, rects[i].y);
+        put_u32(data, (rects[i].packed ? 1 : 0) | (rects[i].rotated ? 2 : 0));
+    }
+
+    // Other processes and threads may be writing the same entry, so the
+    // temporary name is unique to this process and store.
+    static std::atomic<std::uint64_t> temp_counter(0);
+    std::string tmp_path = path + ".tmp" + std::to_string(getpid()) + "-" +
+        std::to_string(temp_counter++);
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if(!f) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = fclose(f) == 0 && ok;
+
+    std::error_code ec;
+    std::uint64_t replaced = fs::file_size(path, ec);
+    if(ec) replaced = 0;
+    if(ok) fs::rename(tmp_path, path, ec);
+    if(!ok || ec)
+    {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+
+    // The directory is only listed once the limit is crossed, and then
+    // trimmed well below it, so most stores don't touch it at all.
+    std::lock_guard<std::mutex> lock(store_mutex);
+    total_bytes += data.size();
+    total_bytes -= std::min(total_bytes, replaced);
+    if(total_bytes > max_bytes) total_bytes = evict(max_bytes / 4 * 3);
+    return true;
+}
+
+std::uint64_t pack_cache::get_hit_count() const
+{
+    return hits;
+}
+
+std::uint64_t pack_cache::get_miss_count() const
+{
+    return misses;
+}
+
+void pack_cache::make_key(
+    const settings& s, const rect_packer::rect* rects, size_t count,
+    std::vector<std::uint32_t>& key
+) const {
+    key = {
+        std::uint32_t(s.packer.size()),
+        std::uint32_t(s.allow_rotation | s.at_once << 1),
+        std::uint32_t(count)
+    };
+    key.reserve(key.size() + s.packer.size() + count * 2);
+    key.insert(key.end(), s.packer.begin(), s.packer.end());
+    for(size_t i = 0; i < count; ++i)
+    {
+        key.push_back(rects[i].w);
+        key.push_back(rects[i].h);
+    }
+}
+
+std::string pack_cache::entry_path(const std::vector<std::uint32_t>& key) const
+{
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)fnv1a(key));
+    return (fs::path(dir) / (name + std::string(entry_extension))).string();
+}
+
+// If the entries take more than max_bytes, removes the least recently used
+// ones until the rest fit in target_bytes. Returns the size of what's left.
+// Temporary files count too, and stale ones are removed on the way. If the
+// directory can't be listed completely, what was listed is still used.
+std::uint64_t pack_cache::evict(std::uint64_t target_bytes)
+{
+    struct entry
+    {
+        fs::path path;
+        fs::file_time_type time;
+        std::uint64_t size;
+    };
+    std::vector<entry> entries;
+    std::uint64_t total = 0;
+
+    // The range-for would throw if advancing the iterator failed.
+    std::error_code ec;
+    fs::file_time_type now = fs::file_time_type::clock::now();
+    for(
+        fs::directory_iterator it(dir, ec), end;
+        !ec && it != end;
+        it.increment(ec)
+    ){
+        const fs::path& path = it->path();
+        bool temp =
+            path.filename().string().find(temp_marker) != std::string::npos;
+        if(!temp && path.extension() != entry_extension) continue;
+
+        std::error_code entry_ec;
+        entry en = {
+            path, fs::last_write_time(path, entry_ec),
+            fs::file_size(path, entry_ec)
+        };
+        if(entry_ec) continue;
+        if(temp)
+        {
+            // Temporary files still being written can't be evicted, but
+            // their space is taken all the same.
+            if(now - en.time > stale_temp_age) fs::remove(path, entry_ec);
+            else total += en.size;
+            continue;
+        }
+        entries.push_back(en);
+        total += en.size;
+    }
+    if(total <= max_bytes) return total;
+
+    std::sort(
+        entries.begin(), entries.end(),
+        [](const entry& a, const entry& b){ return a.time < b.time; }
+    );
+    for(const entry& e: entries)
+    {
+        if(total <= target_bytes) break;
+        if(fs::remove(e.path, ec)) total -= e.size;
+    }
+    return total;
+}
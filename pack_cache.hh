@@ -0,0 +1,100 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_PACK_CACHE_HH
+#define RECT_PACKER_PACK_CACHE_HH
+#include "rect_packer.hh"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// An on-disk cache of packing results. rect_packer is deterministic, so the
+// placements only depend on the rect sizes and the packer's configuration,
+// including the version of the algorithm. Entries are named by a hash of all
+// of those, and each one stores the full key as well, so a hash collision is
+// just a miss.
+//
+// Entries are written to a temporary file and renamed, so an entry is never
+// seen half-written, even with several processes sharing the directory.
+// Loading an entry bumps its modification time, and the least recently used
+// entries are removed once the directory grows past max_bytes. Temporary
+// files count toward it as well, and ones older than an hour, left by a writer
+// that died, are removed. Several threads can use the same pack_cache.
+class pack_cache
+{
+public:
+    // Everything besides the rect sizes that affects the placements. The
+    // canvas size in 'packer' is the initial one; with a growth policy, the
+    // stored result includes the size it grew to.
+    struct settings
+    {
+        // get_config_key() of the packer, before it packs anything.
+        std::vector<std::uint32_t> packer;
+        bool allow_rotation = false;
+        bool at_once = true;
+    };
+
+    // The directory is created if it doesn't exist.
+    pack_cache(
+        const std::string& dir,
+        std::uint64_t max_bytes = std::uint64_t(256) << 20
+    );
+
+    // On a hit, fills in the placements of the rects and the final canvas
+    // size and returns true. Only w and h of the rects are read otherwise.
+    bool load(
+        const settings& s, rect_packer::rect* rects, size_t count,
+        int& canvas_w, int& canvas_h
+    );
+
+    // Stores the placements of the rects. Returns false if the entry couldn't
+    // be written; the cache is only an optimization, so that can usually be
+    // ignored.
+    bool store(
+        const settings& s, const rect_packer::rect* rects, size_t count,
+        int canvas_w, int canvas_h
+    );
+
+    std::uint64_t get_hit_count() const;
+    std::uint64_t get_miss_count() const;
+
+private:
+    void make_key(
+        const settings& s, const rect_packer::rect* rects, size_t count,
+        std::vector<std::uint32_t>& key
+    ) const;
+    std::string entry_path(const std::vector<std::uint32_t>& key) const;
+    std::uint64_t evict(std::uint64_t target_bytes);
+
+    std::string dir;
+    std::uint64_t max_bytes;
+    std::mutex store_mutex;
+    // Approximate, other processes may add entries too. It's recounted
+    // whenever entries are evicted.
+    std::uint64_t total_bytes;
+    std::atomic<std::uint64_t> hits, misses;
+};
+
+#endif
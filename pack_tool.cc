@@ -0,0 +1,564 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// patm-pack: headless packing tool for asset pipelines. Reads jobs (lists of
+// rect sizes) from a file or stdin, packs them on a pool of worker threads and
+// writes the placements out in the same order.
+//
+// Text input format, '#' starts a comment:
+//
+//     job [W H]   Starts a new job, optionally with its own canvas size.
+//     W H         Adds a rect to the current job.
+//
+// Lines can be of any length, but anything else on them is an error. Rects
+// before the first 'job' line belong to an implicit first job. Text
+// output has a header line for each job followed by one line per rect, in
+// input order:
+//
+//     job INDEX PACKED COUNT CANVAS_W CANVAS_H
+//     X Y ROTATED PACKED
+//
+// The binary formats are the same in little-endian 32-bit words. Input is the
+// magic "PATM", version, then for each job: canvas w and h (0 for default),
+// rect count and w, h for each rect. Output is "PATM", version, then for each
+// job: packed, count, canvas w and h, and x, y, flags for each rect (bit 0 is
+// packed, bit 1 rotated).
+//
+// With --corpus, the input is a rect corpus file (see rect_corpus.hh) instead,
+// which is mapped into memory rather than parsed. Each of its groups is a job
+// on the corpus's canvas.
+//
+// With --cache DIR, results are stored in DIR and jobs that have been packed
+// before with the same rects and options are read from there instead of
+// being packed again, see pack_cache.hh.
+#include "rect_packer.hh"
+#include "pack_cache.hh"
+#include "pack_trace.hh"
+#include "rect_corpus.hh"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const char binary_magic[4] = {'P', 'A', 'T', 'M'};
+const std::uint32_t binary_version = 1;
+const int max_threads = 1024;
+
+struct options
+{
+    int w = 1024, h = 1024;
+    int max_w = 0, max_h = 0;
+    bool open = false;
+    bool allow_rotation = false;
+    bool at_once = true;
+    int cell_size = -1;
+    bool binary = false;
+    bool corpus = false;
+    unsigned threads = 0;
+    const char* input = nullptr;
+    const char* output = nullptr;
+    const char* trace_path = nullptr;
+    const char* cache_dir = nullptr;
+    std::uint64_t cache_size = std::uint64_t(256) << 20;
+};
+
+struct job
+{
+    int w, h;
+    std::vector<rect_packer::rect> rects;
+    int packed = 0;
+};
+
+// Reads an int in [min, max] and moves str past it. Anything out of range
+// fails instead of wrapping around or being clamped.
+bool parse_int(const char*& str, int min, int max, int& value)
+{
+    char* end;
+    errno = 0;
+    long parsed = strtol(str, &end, 10);
+    if(end == str || errno == ERANGE || parsed < min || parsed > max)
+        return false;
+    str = end;
+    value = parsed;
+    return true;
+}
+
+// Canvas and rect sides share the packer's limit.
+bool parse_side(const char*& str, int& value)
+{
+    return parse_int(str, 1, rect_packer::get_max_size(), value);
+}
+
+// A whole option value.
+bool parse_option(const char* str, int min, int max, int& value)
+{
+    return parse_int(str, min, max, value) && !*str;
+}
+
+bool parse_size(const char* str, int& w, int& h)
+{
+    return parse_side(str, w) && *str++ == 'x' && parse_side(str, h) && !*str;
+}
+
+// Reads a whole line, however long, including the newline if there is one.
+// Returns false at the end of the input.
+bool read_line(FILE* f, std::string& line)
+{
+    line.clear();
+    char buf[256];
+    while(fgets(buf, sizeof(buf), f))
+    {
+        line += buf;
+        if(line.back() == '\n') return true;
+    }
+    return !line.empty();
+}
+
+bool read_text(FILE* f, const options& opt, std::vector<job>& jobs)
+{
+    std::string line_buf;
+    unsigned line_number = 0;
+    while(read_line(f, line_buf))
+    {
+        line_number++;
+        line_buf.erase(std::min(line_buf.find('#'), line_buf.size()));
+        line_buf.erase(line_buf.find_last_not_of(" \t\r\n") + 1);
+        const char* line = line_buf.c_str();
+
+        int a = 0, b = 0;
+        char word[8];
+        if(sscanf(line, " %7s", word) != 1) continue;
+
+        const char* rest = line;
+        if(!strcmp(word, "job"))
+        {
+            job j;
+            j.w = opt.w;
+            j.h = opt.h;
+            rest = strstr(line, "job") + 3;
+            rest += strspn(rest, " \t\r\n");
+            if(*rest)
+            {
+                if(!parse_side(rest, a) || !parse_side(rest, b))
+                {
+                    fprintf(
+                        stderr, "Line %u: bad job size, sides must be 1-%d\n",
+                        line_number, rect_packer::get_max_size()
+                    );
+                    return false;
+                }
+                j.w = a;
+                j.h = b;
+            }
+            jobs.push_back(j);
+        }
+        else if(parse_side(rest, a) && parse_side(rest, b))
+        {
+            if(jobs.empty()) jobs.push_back({opt.w, opt.h, {}});
+            jobs.back().rects.push_back({a, b});
+        }
+        else
+        {
+            fprintf(
+                stderr, "Line %u: expected 'job' or a rect with sides 1-%d\n",
+                line_number, rect_packer::get_max_size()
+            );
+            return false;
+        }
+
+        rest += strspn(rest, " \t");
+        if(*rest)
+        {
+            fprintf(
+                stderr, "Line %u: unexpected '%s' after the sizes\n",
+                line_number, rest
+            );
+            return false;
+        }
+    }
+    return true;
+}
+
+bool read_u32(FILE* f, std::uint32_t& value)
+{
+    unsigned char bytes[4];
+    if(fread(bytes, 1, 4, f) != 4) return false;
+    value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+        ((std::uint32_t)bytes[3] << 24);
+    return true;
+}
+
+void write_u32(FILE* f, std::uint32_t value)
+{
+    unsigned char bytes[4] = {
+        (unsigned char)value, (unsigned char)(value >> 8),
+        (unsigned char)(value >> 16), (unsigned char)(value >> 24)
+    };
+    fwrite(bytes, 1, 4, f);
+}
+
+bool read_binary(FILE* f, const options& opt, std::vector<job>& jobs)
+{
+    char magic[4];
+    std::uint32_t version = 0;
+    if(
+        fread(magic, 1, 4, f) != 4 ||
+        memcmp(magic, binary_magic, 4) ||
+        !read_u32(f, version) ||
+        version != binary_version
+    ){
+        fprintf(stderr, "Not a version %u binary rect list\n", binary_version);
+        return false;
+    }
+
+    std::uint32_t w, h, count;
+    for(unsigned job_index = 0; read_u32(f, w); ++job_index)
+    {
+        if(!read_u32(f, h) || !read_u32(f, count))
+        {
+            fprintf(stderr, "Truncated job header\n");
+            return false;
+        }
+        const std::uint32_t max_size = rect_packer::get_max_size();
+        if(w > max_size || h > max_size)
+        {
+            fprintf(
+                stderr, "Job %u: bad canvas size, sides must be at most %u\n",
+                job_index, (unsigned)max_size
+            );
+            return false;
+        }
+
+        job j;
+        j.w = w ? w : opt.w;
+        j.h = h ? h : opt.h;
+        // The count can't be trusted before the rects are actually there, so
+        // they're read one at a time.
+        for(std::uint32_t i = 0; i < count; ++i)
+        {
+            std::uint32_t rw, rh;
+            if(!read_u32(f, rw) || !read_u32(f, rh))
+            {
+                fprintf(stderr, "Truncated rect list\n");
+                return false;
+            }
+            if(rw == 0 || rh == 0 || rw > max_size || rh > max_size)
+            {
+                fprintf(
+                    stderr, "Job %u, rect %u: bad size, sides must be 1-%u\n",
+                    job_index, i, (unsigned)max_size
+                );
+                return false;
+            }
+            j.rects.push_back({int(rw), int(rh)});
+        }
+        jobs.push_back(std::move(j));
+    }
+    return true;
+}
+
+void write_text(FILE* f, const std::vector<job>& jobs)
+{
+    for(unsigned i = 0; i < jobs.size(); ++i)
+    {
+        const job& j = jobs[i];
+        fprintf(
+            f, "job %u %d %u %d %d\n",
+            i, j.packed, (unsigned)j.rects.size(), j.w, j.h
+        );
+        for(const rect_packer::rect& r: j.rects)
+            fprintf(f, "%d %d %d %d\n", r.x, r.y, r.rotated, r.packed);
+    }
+}
+
+void write_binary(FILE* f, const std::vector<job>& jobs)
+{
+    fwrite(binary_magic, 1, 4, f);
+    write_u32(f, binary_version);
+    for(const job& j: jobs)
+    {
+        write_u32(f, j.packed);
+        write_u32(f, j.rects.size());
+        write_u32(f, j.w);
+        write_u32(f, j.h);
+        for(const rect_packer::rect& r: j.rects)
+        {
+            write_u32(f, r.x);
+            write_u32(f, r.y);
+            write_u32(f, (r.packed ? 1 : 0) | (r.rotated ? 2 : 0));
+        }
+    }
+}
+
+bool read_corpus(const char* path, const options& opt, std::vector<job>& jobs)
+{
+    rect_corpus corpus;
+    if(!corpus.open(path))
+    {
+        fprintf(stderr, "%s is not a valid rect corpus\n", path);
+        return false;
+    }
+
+    int max_size = rect_packer::get_max_size();
+    if(corpus.get_canvas_w() > max_size || corpus.get_canvas_h() > max_size)
+    {
+        fprintf(
+            stderr, "%s: canvas sides must be at most %d\n", path, max_size
+        );
+        return false;
+    }
+
+    for(size_t g = 0; g < corpus.get_group_count(); ++g)
+    {
+        job j;
+        j.w = corpus.get_canvas_w() ? corpus.get_canvas_w() : opt.w;
+        j.h = corpus.get_canvas_h() ? corpus.get_canvas_h() : opt.h;
+        corpus.get_group(g, j.rects);
+        jobs.push_back(std::move(j));
+    }
+    return true;
+}
+
+int pack_pass(rect_packer& packer, job& j, const options& opt)
+{
+    if(opt.at_once)
+        return packer.pack(j.rects.data(), j.rects.size(), opt.allow_rotation);
+
+    int packed = 0;
+    for(rect_packer::rect& r: j.rects)
+    {
+        if(!r.packed)
+        {
+            r.packed = opt.allow_rotation ?
+                packer.pack_rotate(r.w, r.h, r.x, r.y, r.rotated) :
+                packer.pack(r.w, r.h, r.x, r.y);
+        }
+        if(r.packed) packed++;
+    }
+    return packed;
+}
+
+// If a maximum size is given, the packer grows the canvas by itself, in
+// powers of two, until everything fits or the maximum is reached.
+void run_job(job& j, const options& opt, pack_trace* trace, pack_cache* cache)
+{
+    rect_packer packer(j.w, j.h, opt.open);
+    packer.set_trace(trace);
+    if(opt.cell_size > 0) packer.set_cell_size(opt.cell_size);
+
+    rect_packer::growth_policy growth;
+    growth.max_w = opt.max_w;
+    growth.max_h = opt.max_h;
+    packer.set_growth(growth);
+
+    pack_cache::settings key;
+    packer.get_config_key(key.packer);
+    key.allow_rotation = opt.allow_rotation;
+    key.at_once = opt.at_once;
+    if(cache && cache->load(key, j.rects.data(), j.rects.size(), j.w, j.h))
+    {
+        j.packed = std::count_if(
+            j.rects.begin(), j.rects.end(),
+            [](const rect_packer::rect& r){ return r.packed; }
+        );
+        return;
+    }
+
+    j.packed = pack_pass(packer, j, opt);
+    j.w = packer.get_width();
+    j.h = packer.get_height();
+    if(cache) cache->store(key, j.rects.data(), j.rects.size(), j.w, j.h);
+}
+
+void print_usage(const char* program)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [options] [input]\n"
+        "Reads from stdin if no input file is given. Canvas and rect sides\n"
+        "must be 1-%d.\n"
+        "  --size WxH      Default canvas size (1024x1024)\n"
+        "  --max-size WxH  Grow the canvas up to this size when out of space\n"
+        "  --open          Optimize packing for enlarging the canvas later\n"
+        "  --rotate        Allow 90 degree rotation\n"
+        "  --cell N        Lookup cell size, automatic by default\n"
+        "  --one-by-one    Pack rects in input order instead of as a batch\n"
+        "  --binary        Use the binary formats for input and output\n"
+        "  --corpus        Input is a rect corpus file, one job per group\n"
+        "  --threads N     Number of worker threads (1-%d), all cores by\n"
+        "                  default\n"
+        "  -o FILE         Write output to FILE instead of stdout\n"
+        "  --trace FILE    Write a Chrome trace of the packing to FILE, needs\n"
+        "                  a build with RECT_PACKER_TRACE\n"
+        "  --cache DIR     Reuse results of identical jobs stored in DIR\n"
+        "  --cache-size MB Size limit of the cache directory (256)\n",
+        program, rect_packer::get_max_size(), max_threads
+    );
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    options opt;
+    for(int i = 1; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        int option = i;
+        if(!strcmp(argv[i], "--size") && has_value)
+            ok = parse_size(argv[++i], opt.w, opt.h);
+        else if(!strcmp(argv[i], "--max-size") && has_value)
+            ok = parse_size(argv[++i], opt.max_w, opt.max_h);
+        else if(!strcmp(argv[i], "--open")) opt.open = true;
+        else if(!strcmp(argv[i], "--rotate")) opt.allow_rotation = true;
+        else if(!strcmp(argv[i], "--cell") && has_value)
+        {
+            ok = parse_option(
+                argv[++i], 1, rect_packer::get_max_size(), opt.cell_size
+            );
+        }
+        else if(!strcmp(argv[i], "--one-by-one")) opt.at_once = false;
+        else if(!strcmp(argv[i], "--binary")) opt.binary = true;
+        else if(!strcmp(argv[i], "--corpus")) opt.corpus = true;
+        else if(!strcmp(argv[i], "--threads") && has_value)
+        {
+            int threads = 0;
+            ok = parse_option(argv[++i], 1, max_threads, threads);
+            opt.threads = threads;
+        }
+        else if(!strcmp(argv[i], "-o") && has_value) opt.output = argv[++i];
+        else if(!strcmp(argv[i], "--trace") && has_value)
+            opt.trace_path = argv[++i];
+        else if(!strcmp(argv[i], "--cache") && has_value)
+            opt.cache_dir = argv[++i];
+        else if(!strcmp(argv[i], "--cache-size") && has_value)
+        {
+            int megabytes = 0;
+            ok = parse_option(argv[++i], 0, INT_MAX, megabytes);
+            opt.cache_size = std::uint64_t(megabytes) << 20;
+        }
+        else if(argv[i][0] != '-' || !strcmp(argv[i], "-"))
+            opt.input = argv[i];
+        else ok = false;
+
+        if(!ok)
+        {
+            if(i > option)
+            {
+                fprintf(
+                    stderr, "Bad value for %s: %s\n", argv[option], argv[i]
+                );
+            }
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if(opt.threads == 0)
+        opt.threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::vector<job> jobs;
+    if(opt.corpus)
+    {
+        if(!opt.input || !strcmp(opt.input, "-"))
+        {
+            fprintf(stderr, "--corpus needs an input file\n");
+            return 1;
+        }
+        if(!read_corpus(opt.input, opt, jobs)) return 1;
+    }
+    else
+    {
+        FILE* in = stdin;
+        if(opt.input && strcmp(opt.input, "-"))
+        {
+            in = fopen(opt.input, opt.binary ? "rb" : "r");
+            if(!in)
+            {
+                fprintf(stderr, "Failed to open %s\n", opt.input);
+                return 1;
+            }
+        }
+
+        bool read_ok = opt.binary ?
+            read_binary(in, opt, jobs) : read_text(in, opt, jobs);
+        if(in != stdin) fclose(in);
+        if(!read_ok) return 1;
+    }
+
+    pack_trace trace;
+    pack_trace* job_trace = opt.trace_path ? &trace : nullptr;
+    std::unique_ptr<pack_cache> cache;
+    if(opt.cache_dir)
+        cache.reset(new pack_cache(opt.cache_dir, opt.cache_size));
+
+    // Jobs are independent, so workers just take the next one in line.
+    std::atomic<unsigned> next_job(0);
+    auto worker = [&](){
+        for(;;)
+        {
+            unsigned index = next_job++;
+            if(index >= jobs.size()) break;
+            run_job(jobs[index], opt, job_trace, cache.get());
+        }
+    };
+
+    std::vector<std::thread> pool;
+    unsigned threads = std::min<size_t>(opt.threads, jobs.size());
+    for(unsigned i = 0; i < threads; ++i) pool.emplace_back(worker);
+    for(std::thread& t: pool) t.join();
+
+    if(opt.trace_path && !trace.write_json(opt.trace_path))
+        fprintf(stderr, "Failed to write %s\n", opt.trace_path);
+
+    FILE* out = stdout;
+    if(opt.output)
+    {
+        out = fopen(opt.output, opt.binary ? "wb" : "w");
+        if(!out)
+        {
+            fprintf(stderr, "Failed to open %s\n", opt.output);
+            return 1;
+        }
+    }
+
+    if(opt.binary) write_binary(out, jobs);
+    else write_text(out, jobs);
+    if(out != stdout) fclose(out);
+
+    unsigned failed = 0;
+    for(const job& j: jobs)
+        if(j.packed != (int)j.rects.size()) failed++;
+    return failed ? 2 : 0;
+}
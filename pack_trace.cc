@@ -0,0 +1,148 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "pack_trace.hh"
+#include <atomic>
+
+namespace
+{
+    // Starts from 1, so that 0 never matches a trace.
+    std::atomic<std::uint64_t> trace_id_counter(1);
+
+    // The trace this thread last recorded to and its buffer in it. The
+    // buffer is only used while the id matches, so it can't dangle.
+    thread_local std::uint64_t cached_trace_id = 0;
+    thread_local void* cached_buffer = nullptr;
+}
+
+pack_trace::scope::scope(
+    pack_trace* trace, const char* name, int w, int h, int edges
+): trace(trace)
+{
+    if(!trace) return;
+    ev.name = name;
+    ev.start_ns = trace->now();
+    ev.duration_ns = 0;
+    ev.w = w;
+    ev.h = h;
+    ev.edges = edges;
+    ev.score = -1;
+}
+
+pack_trace::scope::~scope()
+{
+    if(!trace) return;
+    ev.duration_ns = trace->now() - ev.start_ns;
+    trace->record(ev);
+}
+
+void pack_trace::scope::set_score(int score)
+{
+    ev.score = score;
+}
+
+pack_trace::pack_trace()
+: id(trace_id_counter++), epoch(std::chrono::steady_clock::now())
+{
+}
+
+void pack_trace::record(const event& ev)
+{
+    local_buffer().events.push_back(ev);
+}
+
+std::uint64_t pack_trace::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch
+    ).count();
+}
+
+bool pack_trace::write_json(const char* path) const
+{
+    FILE* f = fopen(path, "w");
+    if(!f) return false;
+    write_json(f);
+    return fclose(f) == 0;
+}
+
+void pack_trace::write_json(FILE* f) const
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    bool first = true;
+    fprintf(f, "{\"traceEvents\":[\n");
+    for(const std::unique_ptr<thread_buffer>& buf: buffers)
+    {
+        for(const event& ev: buf->events)
+        {
+            fprintf(
+                f,
+                "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                first ? "" : ",\n", ev.name, buf->index,
+                ev.start_ns / 1000.0, ev.duration_ns / 1000.0
+            );
+            const char* separator = "";
+            if(ev.w >= 0 && ev.h >= 0)
+            {
+                fprintf(f, "\"w\":%d,\"h\":%d", ev.w, ev.h);
+                separator = ",";
+            }
+            if(ev.edges >= 0)
+            {
+                fprintf(f, "%s\"edges\":%d", separator, ev.edges);
+                separator = ",";
+            }
+            if(ev.score >= 0)
+                fprintf(f, "%s\"score\":%d", separator, ev.score);
+            fprintf(f, "}}");
+            first = false;
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+void pack_trace::clear()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for(const std::unique_ptr<thread_buffer>& buf: buffers)
+        buf->events.clear();
+}
+
+pack_trace::thread_buffer& pack_trace::local_buffer()
+{
+    if(cached_trace_id == id)
+        return *static_cast<thread_buffer*>(cached_buffer);
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    thread_buffer*& buf = thread_buffers[std::this_thread::get_id()];
+    if(!buf)
+    {
+        buffers.emplace_back(new thread_buffer);
+        buf = buffers.back().get();
+        buf->index = buffers.size() - 1;
+    }
+    cached_trace_id = id;
+    cached_buffer = buf;
+    return *buf;
+}
@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_PACK_TRACE_HH
+#define RECT_PACKER_PACK_TRACE_HH
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Collects timed events from rect_packers (see rect_packer::set_trace()) and
+// writes them in the Chrome JSON trace format, which can be opened in Perfetto
+// or chrome://tracing. Events are only recorded if RECT_PACKER_TRACE is
+// defined when compiling rect_packer.cc.
+//
+// Each thread records into its own buffer, so recording doesn't lock. A thread
+// remembers the buffer of the trace it last recorded to, and only takes a lock
+// to look up or register a buffer when it switches traces. Any number of
+// packers, on any threads, can share one trace.
+class pack_trace
+{
+public:
+    struct event
+    {
+        const char* name;
+        std::uint64_t start_ns;
+        std::uint64_t duration_ns;
+        // Arguments shown for the event, -1 if they don't apply.
+        int w, h;
+        int edges;
+        int score;
+    };
+
+    // Records one event for its lifetime. Does nothing if trace is null.
+    class scope
+    {
+    public:
+        scope(
+            pack_trace* trace, const char* name,
+            int w = -1, int h = -1, int edges = -1
+        );
+        ~scope();
+
+        void set_score(int score);
+
+    private:
+        pack_trace* trace;
+        event ev;
+    };
+
+    pack_trace();
+
+    void record(const event& ev);
+
+    // Nanoseconds since the trace was created.
+    std::uint64_t now() const;
+
+    // Writes all recorded events. Don't call these while packing is in
+    // progress on other threads.
+    bool write_json(const char* path) const;
+    void write_json(FILE* f) const;
+    void clear();
+
+private:
+    struct thread_buffer
+    {
+        unsigned index;
+        std::vector<event> events;
+    };
+
+    thread_buffer& local_buffer();
+
+    // Never reused, so a thread's remembered buffer can't be mistaken for one
+    // of a new trace after this one is destroyed.
+    std::uint64_t id;
+    std::chrono::steady_clock::time_point epoch;
+    mutable std::mutex registry_mutex;
+    std::vector<std::unique_ptr<thread_buffer>> buffers;
+    std::unordered_map<std::thread::id, thread_buffer*> thread_buffers;
+};
+
+#endif
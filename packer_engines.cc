@@ -0,0 +1,629 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "packer_engines.hh"
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "stb_rect_pack.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+    template<typename A>
+    bool overlaps(const A& a, const A& b)
+    {
+        return a.x < b.x + b.w && b.x < a.x + a.w &&
+            a.y < b.y + b.h && b.y < a.y + a.h;
+    }
+
+    template<typename A>
+    bool contains(const A& outer, const A& inner)
+    {
+        return inner.x >= outer.x && inner.y >= outer.y &&
+            inner.x + inner.w <= outer.x + outer.w &&
+            inner.y + inner.h <= outer.y + outer.h;
+    }
+
+    // stb_rect_pack stores sizes and positions in stbrp_coord, 16 bits unless
+    // STBRP_LARGE_RECTS is defined.
+    const int stb_max_coord = int(std::min<long long>(
+        std::numeric_limits<stbrp_coord>::max(), INT_MAX
+    ));
+
+    bool stb_fits(int w, int h)
+    {
+        return w > 0 && h > 0 && w <= stb_max_coord && h <= stb_max_coord;
+    }
+}
+
+int packer_engine::pack(rect* rects, size_t count, bool allow_rotation)
+{
+    std::vector<rect*> order;
+    for(size_t i = 0; i < count; ++i)
+    {
+        rects[i].rotated = false;
+        order.push_back(rects + i);
+    }
+    std::sort(
+        order.begin(), order.end(),
+        [](const rect* a, const rect* b){
+            return std::max(a->w, a->h) > std::max(b->w, b->h);
+        }
+    );
+
+    int packed = 0;
+    for(rect* r: order)
+    {
+        if(!r->packed)
+        {
+            r->packed = allow_rotation ?
+                pack_rotate(r->w, r->h, r->x, r->y, r->rotated) :
+                pack(r->w, r->h, r->x, r->y);
+        }
+        if(r->packed) packed++;
+    }
+    return packed;
+}
+
+const char* const packer_engine_names[] = {
+    "contact", "maxrects-bssf", "maxrects-baf", "skyline-bl", "guillotine",
+    "stb"
+};
+const size_t packer_engine_count =
+    sizeof(packer_engine_names)/sizeof(*packer_engine_names);
+
+std::unique_ptr<packer_engine> make_packer_engine(
+    const char* name, int w, int h
+){
+    std::unique_ptr<packer_engine> engine;
+    if(!strcmp(name, "contact"))
+        engine.reset(new contact_engine(w, h));
+    else if(!strcmp(name, "maxrects-bssf"))
+        engine.reset(new maxrects_engine(
+            w, h, maxrects_engine::BEST_SHORT_SIDE_FIT
+        ));
+    else if(!strcmp(name, "maxrects-baf"))
+        engine.reset(new maxrects_engine(
+            w, h, maxrects_engine::BEST_AREA_FIT
+        ));
+    else if(!strcmp(name, "skyline-bl"))
+        engine.reset(new skyline_engine(w, h));
+    else if(!strcmp(name, "guillotine"))
+        engine.reset(new guillotine_engine(w, h));
+    else if(!strcmp(name, "stb"))
+        engine.reset(new stb_engine(w, h));
+    return engine;
+}
+
+contact_engine::contact_engine(int w, int h)
+: packer(w, h, false)
+{
+}
+
+const char* contact_engine::get_name() const { return "contact"; }
+
+void contact_engine::reset(int w, int h) { packer.reset(w, h); }
+
+bool contact_engine::enlarge(int w, int h)
+{
+    packer.enlarge(w, h);
+    return true;
+}
+
+int contact_engine::get_width() const { return packer.get_width(); }
+int contact_engine::get_height() const { return packer.get_height(); }
+
+bool contact_engine::pack(int w, int h, int& x, int& y)
+{
+    return packer.pack(w, h, x, y);
+}
+
+bool contact_engine::pack_rotate(int w, int h, int& x, int& y, bool& rotated)
+{
+    return packer.pack_rotate(w, h, x, y, rotated);
+}
+
+int contact_engine::pack(rect* rects, size_t count, bool allow_rotation)
+{
+    return packer.pack(rects, count, allow_rotation);
+}
+
+rect_packer& contact_engine::get_packer() { return packer; }
+
+maxrects_engine::maxrects_engine(int w, int h, heuristic rule)
+: rule(rule)
+{
+    reset(w, h);
+}
+
+const char* maxrects_engine::get_name() const
+{
+    return rule == BEST_AREA_FIT ? "maxrects-baf" : "maxrects-bssf";
+}
+
+void maxrects_engine::reset(int w, int h)
+{
+    canvas_w = w;
+    canvas_h = h;
+    free_areas.clear();
+    if(w > 0 && h > 0) free_areas.push_back({0, 0, w, h});
+}
+
+// Free areas touching the far borders grow with the canvas, and the new
+// strips become free areas of their own.
+bool maxrects_engine::enlarge(int w, int h)
+{
+    w = std::max(w, canvas_w);
+    h = std::max(h, canvas_h);
+    for(area& a: free_areas)
+    {
+        if(a.x + a.w == canvas_w) a.w = w - a.x;
+        if(a.y + a.h == canvas_h) a.h = h - a.y;
+    }
+    if(w > canvas_w) free_areas.push_back({canvas_w, 0, w - canvas_w, h});
+    if(h > canvas_h) free_areas.push_back({0, canvas_h, w, h - canvas_h});
+    canvas_w = w;
+    canvas_h = h;
+    prune(0);
+    return true;
+}
+
+int maxrects_engine::get_width() const { return canvas_w; }
+int maxrects_engine::get_height() const { return canvas_h; }
+
+bool maxrects_engine::pack(int w, int h, int& x, int& y)
+{
+    area best;
+    long long primary, secondary;
+    if(w <= 0 || h <= 0 || !find(w, h, best, primary, secondary))
+        return false;
+    place(best);
+    x = best.x;
+    y = best.y;
+    return true;
+}
+
+bool maxrects_engine::pack_rotate(
+    int w, int h, int& x, int& y, bool& rotated
+){
+    area best, rot_best;
+    long long primary = 0, secondary = 0, rot_primary = 0, rot_secondary = 0;
+    if(w <= 0 || h <= 0) return false;
+    bool found = find(w, h, best, primary, secondary);
+    bool rot_found = find(h, w, rot_best, rot_primary, rot_secondary);
+    if(!found && !rot_found) return false;
+
+    rotated = !found || (
+        rot_found && (
+            rot_primary < primary ||
+            (rot_primary == primary && rot_secondary < secondary)
+        )
+    );
+    if(rotated) best = rot_best;
+    place(best);
+    x = best.x;
+    y = best.y;
+    return true;
+}
+
+bool maxrects_engine::find(
+    int w, int h, area& best, long long& primary, long long& secondary
+) const {
+    bool found = false;
+    for(const area& a: free_areas)
+    {
+        if(a.w < w || a.h < h) continue;
+        long long left_w = a.w - w, left_h = a.h - h;
+        long long p, s;
+        if(rule == BEST_AREA_FIT)
+        {
+            p = a.w * (long long)a.h - w * (long long)h;
+            s = std::min(left_w, left_h);
+        }
+        else
+        {
+            p = std::min(left_w, left_h);
+            s = std::max(left_w, left_h);
+        }
+        if(!found || p < primary || (p == primary && s < secondary))
+        {
+            found = true;
+            best = {a.x, a.y, w, h};
+            primary = p;
+            secondary = s;
+        }
+    }
+    return found;
+}
+
+// Every free area that the rect overlaps is replaced with the up to four
+// maximal areas around the rect.
+void maxrects_engine::place(const area& placed)
+{
+    std::vector<area> split;
+    for(size_t i = 0; i < free_areas.size();)
+    {
+        area a = free_areas[i];
+        if(!overlaps(a, placed))
+        {
+            ++i;
+            continue;
+        }
+
+        if(placed.x > a.x)
+            split.push_back({a.x, a.y, placed.x - a.x, a.h});
+        if(placed.x + placed.w < a.x + a.w)
+        {
+            split.push_back({
+                placed.x + placed.w, a.y,
+                a.x + a.w - placed.x - placed.w, a.h
+            });
+        }
+        if(placed.y > a.y)
+            split.push_back({a.x, a.y, a.w, placed.y - a.y});
+        if(placed.y + placed.h < a.y + a.h)
+        {
+            split.push_back({
+                a.x, placed.y + placed.h,
+                a.w, a.y + a.h - placed.y - placed.h
+            });
+        }
+        free_areas[i] = free_areas.back();
+        free_areas.pop_back();
+    }
+
+    // The remaining areas were already maximal, so only the new ones can be
+    // inside others.
+    size_t first = free_areas.size();
+    free_areas.insert(free_areas.end(), split.begin(), split.end());
+    prune(first);
+}
+
+void maxrects_engine::prune(size_t first)
+{
+    std::vector<bool> removed(free_areas.size(), false);
+    for(size_t i = first; i < free_areas.size(); ++i)
+    for(size_t j = 0; j < free_areas.size(); ++j)
+    {
+        if(i == j || removed[j]) continue;
+        if(!contains(free_areas[j], free_areas[i])) continue;
+        // Of two equal areas, the later one goes.
+        if(contains(free_areas[i], free_areas[j]) && j > i) continue;
+        removed[i] = true;
+        break;
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < free_areas.size(); ++i)
+        if(!removed[i]) free_areas[kept++] = free_areas[i];
+    free_areas.resize(kept);
+}
+
+skyline_engine::skyline_engine(int w, int h)
+{
+    reset(w, h);
+}
+
+const char* skyline_engine::get_name() const { return "skyline-bl"; }
+
+void skyline_engine::reset(int w, int h)
+{
+    canvas_w = w;
+    canvas_h = h;
+    skyline.clear();
+    if(w > 0) skyline.push_back({0, 0, w});
+}
+
+bool skyline_engine::enlarge(int w, int h)
+{
+    if(w > canvas_w)
+    {
+        if(!skyline.empty() && skyline.back().y == 0)
+            skyline.back().w += w - canvas_w;
+        else skyline.push_back({canvas_w, 0, w - canvas_w});
+        canvas_w = w;
+    }
+    canvas_h = std::max(canvas_h, h);
+    return true;
+}
+
+int skyline_engine::get_width() const { return canvas_w; }
+int skyline_engine::get_height() const { return canvas_h; }
+
+bool skyline_engine::pack(int w, int h, int& x, int& y)
+{
+    if(w <= 0 || h <= 0) return false;
+    int i = find(w, h, x, y);
+    if(i < 0) return false;
+    place(i, x, y, w, h);
+    return true;
+}
+
+bool skyline_engine::pack_rotate(
+    int w, int h, int& x, int& y, bool& rotated
+){
+    if(w <= 0 || h <= 0) return false;
+    int rot_x = 0, rot_y = 0;
+    int i = find(w, h, x, y);
+    int rot_i = find(h, w, rot_x, rot_y);
+    if(i < 0 && rot_i < 0) return false;
+
+    // Lower top first, then further left.
+    rotated = i < 0 || (
+        rot_i >= 0 && (
+            rot_y + w < y + h || (rot_y + w == y + h && rot_x < x)
+        )
+    );
+    if(rotated)
+    {
+        x = rot_x;
+        y = rot_y;
+        place(rot_i, x, y, h, w);
+    }
+    else place(i, x, y, w, h);
+    return true;
+}
+
+int skyline_engine::find(int w, int h, int& x, int& y) const
+{
+    int best = -1;
+    int best_top = INT_MAX;
+    for(size_t i = 0; i < skyline.size(); ++i)
+    {
+        int fy = fit(i, w, h);
+        if(fy < 0 || fy + h >= best_top) continue;
+        best = i;
+        best_top = fy + h;
+        x = skyline[i].x;
+        y = fy;
+    }
+    return best;
+}
+
+int skyline_engine::fit(size_t i, int w, int h) const
+{
+    if(skyline[i].x + w > canvas_w) return -1;
+    int y = 0;
+    for(int left = w; left > 0; ++i)
+    {
+        y = std::max(y, skyline[i].y);
+        if(y + h > canvas_h) return -1;
+        left -= skyline[i].w;
+    }
+    return y;
+}
+
+void skyline_engine::place(size_t i, int x, int y, int w, int h)
+{
+    skyline.insert(skyline.begin() + i, {x, y + h, w});
+
+    // Segments under the rect are cut off.
+    for(size_t j = i + 1; j < skyline.size();)
+    {
+        segment& s = skyline[j];
+        if(s.x >= x + w) break;
+        int cut = x + w - s.x;
+        if(cut >= s.w)
+        {
+            skyline.erase(skyline.begin() + j);
+            continue;
+        }
+        s.x += cut;
+        s.w -= cut;
+        break;
+    }
+
+    for(size_t j = 0; j + 1 < skyline.size();)
+    {
+        if(skyline[j].y == skyline[j + 1].y)
+        {
+            skyline[j].w += skyline[j + 1].w;
+            skyline.erase(skyline.begin() + j + 1);
+        }
+        else ++j;
+    }
+}
+
+guillotine_engine::guillotine_engine(int w, int h)
+{
+    reset(w, h);
+}
+
+const char* guillotine_engine::get_name() const { return "guillotine"; }
+
+void guillotine_engine::reset(int w, int h)
+{
+    canvas_w = w;
+    canvas_h = h;
+    free_areas.clear();
+    if(w > 0 && h > 0) free_areas.push_back({0, 0, w, h});
+}
+
+// The new strips are added as free areas of their own, since the existing
+// ones can't be extended without overlapping each other.
+bool guillotine_engine::enlarge(int w, int h)
+{
+    w = std::max(w, canvas_w);
+    h = std::max(h, canvas_h);
+    if(w > canvas_w)
+        free_areas.push_back({canvas_w, 0, w - canvas_w, canvas_h});
+    if(h > canvas_h)
+        free_areas.push_back({0, canvas_h, w, h - canvas_h});
+    canvas_w = w;
+    canvas_h = h;
+    return true;
+}
+
+int guillotine_engine::get_width() const { return canvas_w; }
+int guillotine_engine::get_height() const { return canvas_h; }
+
+bool guillotine_engine::pack(int w, int h, int& x, int& y)
+{
+    if(w <= 0 || h <= 0) return false;
+    long long score;
+    int i = find(w, h, score);
+    if(i < 0) return false;
+    x = free_areas[i].x;
+    y = free_areas[i].y;
+    place(i, w, h);
+    return true;
+}
+
+bool guillotine_engine::pack_rotate(
+    int w, int h, int& x, int& y, bool& rotated
+){
+    if(w <= 0 || h <= 0) return false;
+    long long score = 0, rot_score = 0;
+    int i = find(w, h, score);
+    int rot_i = find(h, w, rot_score);
+    if(i < 0 && rot_i < 0) return false;
+
+    rotated = i < 0 || (rot_i >= 0 && rot_score < score);
+    if(rotated)
+    {
+        i = rot_i;
+        std::swap(w, h);
+    }
+    x = free_areas[i].x;
+    y = free_areas[i].y;
+    place(i, w, h);
+    return true;
+}
+
+int guillotine_engine::find(int w, int h, long long& score) const
+{
+    int best = -1;
+    for(size_t i = 0; i < free_areas.size(); ++i)
+    {
+        const area& a = free_areas[i];
+        if(a.w < w || a.h < h) continue;
+        long long s = a.w * (long long)a.h - w * (long long)h;
+        if(best < 0 || s < score)
+        {
+            best = i;
+            score = s;
+        }
+    }
+    return best;
+}
+
+// The leftover L-shape is cut along the shorter leftover axis, so that the
+// larger piece stays as large as possible.
+void guillotine_engine::place(size_t index, int w, int h)
+{
+    area a = free_areas[index];
+    free_areas[index] = free_areas.back();
+    free_areas.pop_back();
+
+    int left_w = a.w - w, left_h = a.h - h;
+    bool horizontal = left_w <= left_h;
+    area right = {a.x + w, a.y, left_w, horizontal ? h : a.h};
+    area top = {a.x, a.y + h, horizontal ? a.w : w, left_h};
+    if(right.w > 0 && right.h > 0) free_areas.push_back(right);
+    if(top.w > 0 && top.h > 0) free_areas.push_back(top);
+}
+
+struct stb_engine::state
+{
+    stbrp_context ctx;
+    std::vector<stbrp_node> nodes;
+};
+
+stb_engine::stb_engine(int w, int h)
+: st(new state())
+{
+    reset(w, h);
+}
+
+stb_engine::~stb_engine() = default;
+
+const char* stb_engine::get_name() const { return "stb"; }
+
+void stb_engine::reset(int w, int h)
+{
+    canvas_w = std::min(std::max(w, 0), stb_max_coord);
+    canvas_h = std::min(std::max(h, 0), stb_max_coord);
+    st->nodes.resize(std::max(canvas_w, 1));
+    stbrp_init_target(
+        &st->ctx, canvas_w, canvas_h, st->nodes.data(), st->nodes.size()
+    );
+}
+
+bool stb_engine::enlarge(int w, int h)
+{
+    return w <= canvas_w && h <= canvas_h;
+}
+
+int stb_engine::get_width() const { return canvas_w; }
+int stb_engine::get_height() const { return canvas_h; }
+
+bool stb_engine::pack(int w, int h, int& x, int& y)
+{
+    if(!stb_fits(w, h)) return false;
+    stbrp_rect r = {};
+    r.w = (stbrp_coord)w;
+    r.h = (stbrp_coord)h;
+    stbrp_pack_rects(&st->ctx, &r, 1);
+    if(!r.was_packed) return false;
+    x = r.x;
+    y = r.y;
+    return true;
+}
+
+bool stb_engine::pack_rotate(int w, int h, int& x, int& y, bool& rotated)
+{
+    rotated = false;
+    return pack(w, h, x, y);
+}
+
+int stb_engine::pack(rect* rects, size_t count, bool)
+{
+    std::vector<stbrp_rect> tmp;
+    for(size_t i = 0; i < count; ++i)
+    {
+        rects[i].rotated = false;
+        if(rects[i].packed || !stb_fits(rects[i].w, rects[i].h)) continue;
+        stbrp_rect r = {};
+        r.id = i;
+        r.w = (stbrp_coord)rects[i].w;
+        r.h = (stbrp_coord)rects[i].h;
+        tmp.push_back(r);
+    }
+    stbrp_pack_rects(&st->ctx, tmp.data(), tmp.size());
+
+    for(const stbrp_rect& r: tmp)
+    {
+        if(!r.was_packed) continue;
+        rect& dst = rects[r.id];
+        dst.packed = true;
+        dst.x = r.x;
+        dst.y = r.y;
+    }
+
+    int packed = 0;
+    for(size_t i = 0; i < count; ++i)
+        if(rects[i].packed) packed++;
+    return packed;
+}
@@ -0,0 +1,220 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_PACKER_ENGINES_HH
+#define RECT_PACKER_PACKER_ENGINES_HH
+#include "rect_packer.hh"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// A common interface for different packing algorithms, so that the algorithm
+// can be picked per atlas without touching the call sites. The functions work
+// like the ones in rect_packer. The engines are:
+//
+// contact:       rect_packer itself, the best packing but the slowest.
+// maxrects-bssf: MaxRects with the best short side fit rule.
+// maxrects-baf:  MaxRects with the best area fit rule.
+// skyline-bl:    Skyline, bottom-left rule. Very fast, wastes the space
+//                under overhangs.
+// guillotine:    Guillotine with best area fit and shorter leftover axis
+//                splits. Fast, but the splits can't be undone.
+// stb:           stb_rect_pack, a skyline packer. It can't rotate or grow.
+class packer_engine
+{
+public:
+    typedef rect_packer::rect rect;
+
+    virtual ~packer_engine() = default;
+
+    virtual const char* get_name() const = 0;
+
+    // Clears everything and sets the canvas size.
+    virtual void reset(int w, int h) = 0;
+
+    // Grows the canvas without clearing the packed rects. Returns false and
+    // changes nothing if the engine can't grow.
+    virtual bool enlarge(int w, int h) = 0;
+
+    virtual int get_width() const = 0;
+    virtual int get_height() const = 0;
+
+    virtual bool pack(int w, int h, int& x, int& y) = 0;
+    virtual bool pack_rotate(int w, int h, int& x, int& y, bool& rotated) = 0;
+
+    // By default, the rects are sorted like in rect_packer's batch pack()
+    // and packed one by one. Engines with a batch mode of their own override
+    // this.
+    virtual int pack(rect* rects, size_t count, bool allow_rotation = false);
+};
+
+// Returns null if there's no engine with that name.
+std::unique_ptr<packer_engine> make_packer_engine(
+    const char* name, int w, int h
+);
+
+// The names accepted by make_packer_engine().
+extern const char* const packer_engine_names[];
+extern const size_t packer_engine_count;
+
+class contact_engine: public packer_engine
+{
+public:
+    contact_engine(int w, int h);
+
+    const char* get_name() const override;
+    void reset(int w, int h) override;
+    bool enlarge(int w, int h) override;
+    int get_width() const override;
+    int get_height() const override;
+    bool pack(int w, int h, int& x, int& y) override;
+    bool pack_rotate(int w, int h, int& x, int& y, bool& rotated) override;
+    int pack(rect* rects, size_t count, bool allow_rotation = false) override;
+
+    // For the settings that only rect_packer has.
+    rect_packer& get_packer();
+
+private:
+    rect_packer packer;
+};
+
+class maxrects_engine: public packer_engine
+{
+public:
+    enum heuristic
+    {
+        BEST_SHORT_SIDE_FIT,
+        BEST_AREA_FIT
+    };
+
+    maxrects_engine(int w, int h, heuristic rule = BEST_SHORT_SIDE_FIT);
+
+    const char* get_name() const override;
+    void reset(int w, int h) override;
+    bool enlarge(int w, int h) override;
+    int get_width() const override;
+    int get_height() const override;
+    bool pack(int w, int h, int& x, int& y) override;
+    bool pack_rotate(int w, int h, int& x, int& y, bool& rotated) override;
+    using packer_engine::pack;
+
+private:
+    struct area { int x, y, w, h; };
+
+    // Scores are compared lexicographically, smaller is better.
+    bool find(
+        int w, int h, area& best, long long& primary, long long& secondary
+    ) const;
+    void place(const area& placed);
+    // Removes the free areas from 'first' on that are inside other ones.
+    void prune(size_t first);
+
+    int canvas_w, canvas_h;
+    heuristic rule;
+    // The maximal free rects, they may overlap each other.
+    std::vector<area> free_areas;
+};
+
+class skyline_engine: public packer_engine
+{
+public:
+    skyline_engine(int w, int h);
+
+    const char* get_name() const override;
+    void reset(int w, int h) override;
+    bool enlarge(int w, int h) override;
+    int get_width() const override;
+    int get_height() const override;
+    bool pack(int w, int h, int& x, int& y) override;
+    bool pack_rotate(int w, int h, int& x, int& y, bool& rotated) override;
+    using packer_engine::pack;
+
+private:
+    struct segment { int x, y, w; };
+
+    // Returns the index of the segment to place at, or -1.
+    int find(int w, int h, int& x, int& y) const;
+    // The lowest y where a w-wide rect starting at segment i fits, or -1.
+    int fit(size_t i, int w, int h) const;
+    void place(size_t i, int x, int y, int w, int h);
+
+    int canvas_w, canvas_h;
+    // Sorted by x, covers the whole width.
+    std::vector<segment> skyline;
+};
+
+class guillotine_engine: public packer_engine
+{
+public:
+    guillotine_engine(int w, int h);
+
+    const char* get_name() const override;
+    void reset(int w, int h) override;
+    bool enlarge(int w, int h) override;
+    int get_width() const override;
+    int get_height() const override;
+    bool pack(int w, int h, int& x, int& y) override;
+    bool pack_rotate(int w, int h, int& x, int& y, bool& rotated) override;
+    using packer_engine::pack;
+
+private:
+    struct area { int x, y, w, h; };
+
+    int find(int w, int h, long long& score) const;
+    void place(size_t index, int w, int h);
+
+    int canvas_w, canvas_h;
+    // Disjoint free rects.
+    std::vector<area> free_areas;
+};
+
+class stb_engine: public packer_engine
+{
+public:
+    stb_engine(int w, int h);
+    ~stb_engine();
+
+    const char* get_name() const override;
+    // stb_rect_pack stores coordinates in 16 bits unless STBRP_LARGE_RECTS
+    // is defined. Larger canvas sizes are clamped to that, and larger rects
+    // are never packed.
+    void reset(int w, int h) override;
+    // stb_rect_pack can't grow, so this only succeeds if the size doesn't
+    // change.
+    bool enlarge(int w, int h) override;
+    int get_width() const override;
+    int get_height() const override;
+    bool pack(int w, int h, int& x, int& y) override;
+    // Never rotates.
+    bool pack_rotate(int w, int h, int& x, int& y, bool& rotated) override;
+    // Uses stb_rect_pack's own batch mode.
+    int pack(rect* rects, size_t count, bool allow_rotation = false) override;
+
+private:
+    // Keeps stb_rect_pack.h out of this header.
+    struct state;
+    std::unique_ptr<state> st;
+    int canvas_w, canvas_h;
+};
+
+#endif
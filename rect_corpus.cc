@@ -0,0 +1,254 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "rect_corpus.hh"
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#if defined(__unix__) || defined(__APPLE__)
+#define RECT_CORPUS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char corpus_magic[4] = {'P', 'A', 'T', 'R'};
+    const std::uint32_t corpus_version = 1;
+
+    static_assert(
+        sizeof(rect_corpus::header) == 32 && sizeof(rect_corpus::record) == 8,
+        "The corpus structs must match the file layout"
+    );
+
+    bool little_endian()
+    {
+        const std::uint32_t one = 1;
+        unsigned char first;
+        memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    bool valid_canvas(std::uint64_t w, std::uint64_t h)
+    {
+        return w > 0 && h > 0 && w <= INT_MAX && h <= INT_MAX;
+    }
+
+    bool valid_records(const rect_corpus::record* records, size_t count)
+    {
+        for(size_t i = 0; i < count; ++i)
+            if(records[i].w == 0 || records[i].h == 0) return false;
+        return true;
+    }
+}
+
+rect_corpus::rect_corpus()
+: data(nullptr), size(0), mapped(false), head(nullptr), records(nullptr),
+  group_ends(nullptr)
+{
+}
+
+rect_corpus::~rect_corpus()
+{
+    close();
+}
+
+bool rect_corpus::open(const char* path)
+{
+    close();
+    // The records are used as they are, so the host must match the file.
+    if(!little_endian()) return false;
+
+#ifdef RECT_CORPUS_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(ptr != MAP_FAILED)
+        {
+            data = (const unsigned char*)ptr;
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+    ::close(fd);
+#endif
+
+    if(!mapped)
+    {
+        FILE* f = fopen(path, "rb");
+        if(!f) return false;
+        // Read in 8-byte words so that the records are aligned.
+        std::uint64_t word;
+        size_t n;
+        while((n = fread(&word, 1, sizeof(word), f)) > 0)
+        {
+            buffer.push_back(word);
+            size += n;
+        }
+        bool ok = !ferror(f);
+        fclose(f);
+        if(!ok)
+        {
+            close();
+            return false;
+        }
+        data = (const unsigned char*)buffer.data();
+    }
+
+    head = (const header*)data;
+    std::uint64_t expected = sizeof(header);
+    bool ok = size >= sizeof(header) &&
+        !memcmp(head->magic, corpus_magic, 4) &&
+        head->version == corpus_version &&
+        valid_canvas(head->canvas_w, head->canvas_h);
+    if(ok)
+    {
+        expected += std::uint64_t(head->rect_count) * sizeof(record) +
+            std::uint64_t(head->group_count) * 4;
+        ok = size == expected;
+    }
+    if(ok)
+    {
+        records = (const record*)(data + sizeof(header));
+        group_ends = (const std::uint32_t*)(records + head->rect_count);
+        std::uint32_t prev = 0;
+        for(std::uint32_t i = 0; ok && i < head->group_count; ++i)
+        {
+            ok = group_ends[i] >= prev && group_ends[i] <= head->rect_count;
+            prev = group_ends[i];
+        }
+        ok = ok && (head->group_count == 0 || prev == head->rect_count);
+        ok = ok && valid_records(records, head->rect_count);
+    }
+
+    if(!ok) close();
+    return ok;
+}
+
+void rect_corpus::close()
+{
+#ifdef RECT_CORPUS_MMAP
+    if(mapped) munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    buffer.clear();
+    head = nullptr;
+    records = nullptr;
+    group_ends = nullptr;
+}
+
+bool rect_corpus::is_mapped() const
+{
+    return mapped;
+}
+
+int rect_corpus::get_canvas_w() const
+{
+    return head ? head->canvas_w : 0;
+}
+
+int rect_corpus::get_canvas_h() const
+{
+    return head ? head->canvas_h : 0;
+}
+
+size_t rect_corpus::get_rect_count() const
+{
+    return head ? head->rect_count : 0;
+}
+
+const rect_corpus::record* rect_corpus::get_records() const
+{
+    return records;
+}
+
+size_t rect_corpus::get_group_count() const
+{
+    if(!head) return 0;
+    if(head->group_count == 0) return head->rect_count ? 1 : 0;
+    return head->group_count;
+}
+
+size_t rect_corpus::get_group_begin(size_t group) const
+{
+    return group == 0 ? 0 : get_group_end(group - 1);
+}
+
+size_t rect_corpus::get_group_end(size_t group) const
+{
+    return head->group_count == 0 ? head->rect_count : group_ends[group];
+}
+
+void rect_corpus::get_group(
+    size_t group, std::vector<rect_packer::rect>& rects
+) const {
+    size_t end = get_group_end(group);
+    for(size_t i = get_group_begin(group); i < end; ++i)
+        rects.push_back({records[i].w, records[i].h});
+}
+
+bool rect_corpus::write(
+    const char* path, int canvas_w, int canvas_h,
+    const record* records, size_t count,
+    const std::uint32_t* group_ends, size_t group_count
+){
+    if(
+        !little_endian() || canvas_w <= 0 || canvas_h <= 0 ||
+        count > UINT32_MAX || group_count > UINT32_MAX ||
+        (count > 0 && !records) || (group_count > 0 && !group_ends) ||
+        !valid_records(records, count)
+    ) return false;
+
+    std::uint32_t prev = 0;
+    for(size_t i = 0; i < group_count; ++i)
+    {
+        if(group_ends[i] < prev || group_ends[i] > count) return false;
+        prev = group_ends[i];
+    }
+    if(group_count > 0 && prev != count) return false;
+
+    header head = {};
+    memcpy(head.magic, corpus_magic, 4);
+    head.version = corpus_version;
+    head.rect_count = count;
+    head.group_count = group_count;
+    head.canvas_w = canvas_w;
+    head.canvas_h = canvas_h;
+
+    FILE* f = fopen(path, "wb");
+    if(!f) return false;
+    bool ok = fwrite(&head, sizeof(head), 1, f) == 1 &&
+        (count == 0 || fwrite(records, sizeof(record), count, f) == count) &&
+        (
+            group_count == 0 ||
+            fwrite(group_ends, 4, group_count, f) == group_count
+        );
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,112 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_RECT_CORPUS_HH
+#define RECT_PACKER_RECT_CORPUS_HH
+#include "rect_packer.hh"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A fixed set of rect sizes in a binary file, so that benchmarks and replays
+// use exactly the same inputs on every machine. The file is laid out so that
+// it can be used straight from memory, without any parsing:
+//
+//     header       "PATR", version, rect count, group count, canvas w and h,
+//                  two reserved words (zero), all 32-bit
+//     records      rect count times: 16-bit w and h, 32-bit flags
+//     group ends   group count times: 32-bit index one past the group's last
+//                  rect, increasing, the last one equal to the rect count
+//
+// Everything is little-endian. Groups are the batches in which the rects
+// arrive, e.g. one per font size or level. Without any, all rects form one
+// group. Flags aren't used by the packers; the reference corpora store the
+// id of the glyph, mesh or animation there.
+class rect_corpus
+{
+public:
+    struct header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t rect_count;
+        std::uint32_t group_count;
+        std::uint32_t canvas_w, canvas_h;
+        std::uint32_t reserved[2];
+    };
+
+    struct record
+    {
+        std::uint16_t w, h;
+        std::uint32_t flags;
+    };
+
+    rect_corpus();
+    rect_corpus(const rect_corpus& other) = delete;
+    ~rect_corpus();
+
+    rect_corpus& operator=(const rect_corpus& other) = delete;
+
+    // Maps the file into memory, or reads it where that isn't available.
+    // Returns false if the file can't be opened or isn't a valid corpus,
+    // which includes an empty canvas or a rect with a zero width or height.
+    bool open(const char* path);
+    void close();
+
+    // True if the file is used through a memory mapping.
+    bool is_mapped() const;
+
+    int get_canvas_w() const;
+    int get_canvas_h() const;
+
+    size_t get_rect_count() const;
+    const record* get_records() const;
+
+    // At least one if there are any rects.
+    size_t get_group_count() const;
+    size_t get_group_begin(size_t group) const;
+    size_t get_group_end(size_t group) const;
+
+    // Appends the rects of a group to 'rects', unpacked.
+    void get_group(size_t group, std::vector<rect_packer::rect>& rects) const;
+
+    // records and group_ends can be null if their count is zero. Returns
+    // false without writing anything if open() would reject the result.
+    static bool write(
+        const char* path, int canvas_w, int canvas_h,
+        const record* records, size_t count,
+        const std::uint32_t* group_ends, size_t group_count
+    );
+
+private:
+    const unsigned char* data;
+    size_t size;
+    bool mapped;
+    std::vector<std::uint64_t> buffer;
+
+    const header* head;
+    const record* records;
+    const std::uint32_t* group_ends;
+};
+
+#endif
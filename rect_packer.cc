@@ -22,9 +22,32 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include "rect_packer.hh"
+#include "cell_size_table.hh"
 #include <algorithm>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <limits>
+#ifdef RECT_PACKER_STATS
+#include <chrono>
+#endif
+#ifdef RECT_PACKER_TRACE
+#include "pack_trace.hh"
+#endif
+
+// Wraps statements that only exist to collect rect_packer_stats.
+#ifdef RECT_PACKER_STATS
+#define RECT_PACKER_STAT(...) __VA_ARGS__
+#else
+#define RECT_PACKER_STAT(...)
+#endif
+
+// Same for the pack_trace events.
+#ifdef RECT_PACKER_TRACE
+#define RECT_PACKER_TRACE_EVENT(...) __VA_ARGS__
+#else
+#define RECT_PACKER_TRACE_EVENT(...)
+#endif
 
 namespace
 {
@@ -33,150 +56,556 @@ namespace
         return std::max(std::min(x1 + w1, x2 + w2) - std::max(x1, x2), 0);
     }
 
-    int get_cell_size(int total_area)
+    // The table is measured by patm-autotune. The rows are log2 of the
+    // canvas area and the columns log2 of the mean rect size.
+    int get_cell_size(std::uint64_t total_area, double mean_size)
     {
-        // Largely empirical, I tested different cell sizes for different sizes
-        // of squares. This equation mostly follows the resulting values.
-        return ceil(pow(total_area, 1.0/6.0));
+        int row = 0;
+        while(row + 1 < cell_size_table_rows && (total_area >> (row + 1)))
+            row++;
+        int col = cell_size_table_default_col;
+        if(mean_size >= 1)
+            col = std::min(int(std::log2(mean_size)), cell_size_table_cols - 1);
+        return cell_size_table[row][col];
     }
+
+    struct box
+    {
+        int x, y, w, h;
+    };
+
+    // Sorts items into buckets with a counting sort. bucket_of(item) must be
+    // in [0, bucket_count). Afterwards, bucket i is in
+    // sorted[start[i]..start[i+1]).
+    template<typename I, typename F>
+    void bucket_sort(
+        const std::vector<I>& items, int bucket_count, F&& bucket_of,
+        std::vector<I>& sorted, std::vector<std::uint32_t>& start
+    ){
+        start.assign(bucket_count + 1, 0);
+        for(const I& item: items) start[bucket_of(item) + 1]++;
+        for(int i = 0; i < bucket_count; ++i) start[i + 1] += start[i];
+
+        std::vector<std::uint32_t> next(start.begin(), start.end() - 1);
+        sorted.resize(items.size());
+        for(const I& item: items) sorted[next[bucket_of(item)]++] = item;
+    }
+
+    // Buckets are hashed from coordinates, and there are about as many
+    // buckets as items, so the cost follows the item count and not the
+    // canvas area. Returns a power of two.
+    int hash_bucket_count(size_t items)
+    {
+        int count = 1;
+        while(size_t(count) < items) count <<= 1;
+        return count;
+    }
+
+    int hash_bucket(int x, int y, int bucket_count)
+    {
+        std::uint64_t h =
+            (std::uint64_t(std::uint32_t(x)) << 32) | std::uint32_t(y);
+        h *= 0x9E3779B97F4A7C15ull;
+        return int((h >> 32) & std::uint64_t(bucket_count - 1));
+    }
+
+    // A hash set of lines that numbers them in insertion order, so spans
+    // can be bucketed per line without a table the size of the canvas.
+    class line_set
+    {
+    public:
+        explicit line_set(size_t capacity)
+        : slots(hash_bucket_count(capacity * 2), slot{-1, 0}), count(0)
+        {
+        }
+
+        void insert(int line)
+        {
+            int mask = int(slots.size()) - 1;
+            for(int i = hash_bucket(line, 0, mask + 1);; i = (i + 1) & mask)
+            {
+                if(slots[i].line == line) return;
+                if(slots[i].line < 0)
+                {
+                    slots[i] = {line, count++};
+                    return;
+                }
+            }
+        }
+
+        // Returns the number of the line, or -1 if it's not in the set.
+        int find(int line) const
+        {
+            int mask = int(slots.size()) - 1;
+            for(int i = hash_bucket(line, 0, mask + 1);; i = (i + 1) & mask)
+            {
+                if(slots[i].line == line) return slots[i].index;
+                if(slots[i].line < 0) return -1;
+            }
+        }
+
+        int size() const { return count; }
+
+    private:
+        struct slot
+        {
+            int line, index;
+        };
+        std::vector<slot> slots;
+        int count;
+    };
+
+    // True if any two boxes overlap. Each box is listed once per grid cell
+    // it touches, and only boxes whose cells land in the same bucket are
+    // compared. Boxes that don't overlap can only crowd a cell so much, so
+    // this is close to linear.
+    bool boxes_overlap(const std::vector<box>& boxes, int cell_size)
+    {
+        size_t entry_count = 0;
+        for(const box& b: boxes)
+        {
+            entry_count += size_t((b.x + b.w - 1)/cell_size - b.x/cell_size + 1)
+                * size_t((b.y + b.h - 1)/cell_size - b.y/cell_size + 1);
+        }
+        int bucket_count = hash_bucket_count(entry_count);
+
+        // Each box is listed once per cell it touches.
+        typedef std::pair<int, std::uint32_t> entry;
+        std::vector<entry> entries;
+        entries.reserve(entry_count);
+        for(std::uint32_t i = 0; i < boxes.size(); ++i)
+        {
+            const box& b = boxes[i];
+            for(int cy = b.y/cell_size; cy <= (b.y+b.h-1)/cell_size; ++cy)
+            for(int cx = b.x/cell_size; cx <= (b.x+b.w-1)/cell_size; ++cx)
+                entries.push_back({hash_bucket(cx, cy, bucket_count), i});
+        }
+
+        std::vector<entry> sorted;
+        std::vector<std::uint32_t> start;
+        bucket_sort(
+            entries, bucket_count,
+            [](const entry& e){ return e.first; },
+            sorted, start
+        );
+
+        for(int bucket = 0; bucket < bucket_count; ++bucket)
+        for(std::uint32_t i = start[bucket]; i < start[bucket+1]; ++i)
+        for(std::uint32_t j = i + 1; j < start[bucket+1]; ++j)
+        {
+            if(sorted[i].second == sorted[j].second) continue;
+            const box& a = boxes[sorted[i].second];
+            const box& b = boxes[sorted[j].second];
+            if(
+                calc_overlap(a.x, a.w, b.x, b.w) > 0 &&
+                calc_overlap(a.y, a.h, b.y, b.h) > 0
+            ) return true;
+        }
+        return false;
+    }
+
+    // A piece of a line that is occupied on one side: either a free edge
+    // or a side of a newly placed rect.
+    struct boundary_span
+    {
+        int line, start, end;
+        bool occupied_left;
+    };
+
+    // Calls f(line, start, length, up_right_inside) for every maximal run of
+    // each line where exactly one side is occupied. The lines of all spans
+    // must be in the set, and spans occupied on the same side must not
+    // overlap.
+    template<typename F>
+    void sweep_boundaries(
+        const std::vector<boundary_span>& spans, const line_set& lines, F&& f
+    ){
+        std::vector<boundary_span> sorted;
+        std::vector<std::uint32_t> start;
+        bucket_sort(
+            spans, lines.size(),
+            [&](const boundary_span& s){ return lines.find(s.line); },
+            sorted, start
+        );
+
+        struct event
+        {
+            int pos;
+            int side;
+            int delta;
+        };
+        std::vector<event> events;
+
+        for(int index = 0; index < lines.size(); ++index)
+        {
+            if(start[index] == start[index+1]) continue;
+            int line = sorted[start[index]].line;
+
+            events.clear();
+            for(std::uint32_t i = start[index]; i < start[index+1]; ++i)
+            {
+                const boundary_span& span = sorted[i];
+                int side = span.occupied_left ? 0 : 1;
+                events.push_back({span.start, side, 1});
+                events.push_back({span.end, side, -1});
+            }
+            std::sort(
+                events.begin(), events.end(),
+                [](const event& a, const event& b){ return a.pos < b.pos; }
+            );
+
+            // State 1 means occupied on the left only, 2 on the right only.
+            int count[2] = {0, 0};
+            int run_start = 0;
+            int run_state = 0;
+            for(size_t i = 0; i < events.size();)
+            {
+                int pos = events[i].pos;
+                for(; i < events.size() && events[i].pos == pos; ++i)
+                    count[events[i].side] += events[i].delta;
+
+                int state = 0;
+                if(count[0] > 0 && count[1] == 0) state = 1;
+                else if(count[1] > 0 && count[0] == 0) state = 2;
+
+                if(state != run_state)
+                {
+                    if(run_state != 0)
+                        f(line, run_start, pos - run_start, run_state == 1);
+                    run_start = pos;
+                    run_state = state;
+                }
+            }
+        }
+    }
+
+#ifdef RECT_PACKER_STATS
+    // Adds the time between construction and destruction to a total and/or a
+    // histogram.
+    class stat_timer
+    {
+    public:
+        stat_timer(
+            std::uint64_t* total,
+            rect_packer_stats::latency_histogram* histogram = nullptr
+        ): total(total), histogram(histogram),
+           start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~stat_timer()
+        {
+            std::chrono::steady_clock::duration elapsed =
+                std::chrono::steady_clock::now() - start;
+            std::uint64_t ns =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    elapsed
+                ).count();
+            if(total) *total += ns;
+            if(histogram) histogram->add(ns);
+        }
+
+    private:
+        std::uint64_t* total;
+        rect_packer_stats::latency_histogram* histogram;
+        std::chrono::steady_clock::time_point start;
+    };
+#endif
 }
 
-rect_packer::rect_packer(int w, int h, bool open)
-: canvas_w(w), canvas_h(h), cell_size(16), open(open), marker(0)
+void rect_packer_stats::latency_histogram::add(std::uint64_t ns)
+{
+    int bucket = 0;
+    while(bucket < bucket_count - 1 && (ns >> (bucket + 1)) != 0) bucket++;
+    buckets[bucket]++;
+    calls++;
+    total_ns += ns;
+    if(ns > max_ns) max_ns = ns;
+}
+
+template<typename T, typename O, typename R, typename S>
+basic_rect_packer<T, O, R, S>::basic_rect_packer(int w, int h, bool open)
+: canvas_w(w), canvas_h(h), lookup_w(0), lookup_h(0), blocks_w(0),
+  blocks_h(0), cell_size(16), fixed_cell_size(false), rect_size_sum(0),
+  rect_size_count(0), open(open),
+  open_setting(open), corner_search(false), refine_edges(0),
+  block_runs(false), marker(0), count_visits(false), stats(),
+  trace(nullptr)
 {
     reset(w, h);
 }
 
-void rect_packer::enlarge(int w, int h)
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::enlarge(int w, int h)
 {
+    RECT_PACKER_STAT(stat_timer timer(nullptr, &stats.enlarge);)
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(trace, "enlarge", w, h, edges.size());
+    )
     tmp.clear();
 
     std::vector<free_edge> top_edges, right_edges;
 
-    w = std::max(canvas_w, w);
-    h = std::max(canvas_h, h);
+    w = std::min(std::max(canvas_w, w), get_max_size());
+    h = std::min(std::max(canvas_h, h), get_max_size());
+    if(w == canvas_w && h == canvas_h) return;
 
-    marker++;
+    next_marker();
     if(h > canvas_h)
     {
-        top_edges.push_back({0, canvas_h, canvas_w, false, true, marker});
+        top_edges.push_back(make_edge(0, canvas_h, canvas_w, false, true));
 
         for(int i = 0; i < lookup_w; ++i)
         {
-            auto& cell = edge_lookup[(lookup_h-1) * lookup_w + i];
-            for(free_edge* edge: cell)
+            cell_page* page = find_page(i, lookup_h-1);
+            if(!page) continue;
+            for(edge_index index: page->cells[cell_in_page(i, lookup_h-1)])
             {
+                free_edge& edge = edges[index];
                 if(
-                    edge->vertical ||
-                    edge->y != canvas_h ||
-                    edge->marker == marker
+                    edge.vertical() ||
+                    edge.y != canvas_h ||
+                    edge.marker() == marker
                 ) continue;
-                edge->marker = marker;
-                edge_clip(*edge, top_edges);
-                tmp.push_back(edge);
+                edge.set_marker(marker);
+                edge_clip(edge, top_edges);
+                tmp.push_back(index);
             }
         }
 
-        top_edges.push_back({0, canvas_h, h-canvas_h, true, true, marker});
-        top_edges.push_back({0, h, w, false, false, marker});
+        top_edges.push_back(make_edge(0, canvas_h, h-canvas_h, true, true));
+        top_edges.push_back(make_edge(0, h, w, false, false));
         if(w <= canvas_w)
-            top_edges.push_back({w, canvas_h, h-canvas_h, true, false, marker});
+            top_edges.push_back(
+                make_edge(w, canvas_h, h-canvas_h, true, false)
+            );
     }
 
     if(w > canvas_w)
     {
-        right_edges.push_back({canvas_w, 0, canvas_h, true, true, marker});
+        right_edges.push_back(make_edge(canvas_w, 0, canvas_h, true, true));
 
         for(int i = 0; i < lookup_h; ++i)
         {
-            auto& cell = edge_lookup[i * lookup_w + lookup_w - 1];
-            for(free_edge* edge: cell)
+            cell_page* page = find_page(lookup_w-1, i);
+            if(!page) continue;
+            for(edge_index index: page->cells[cell_in_page(lookup_w-1, i)])
             {
+                free_edge& edge = edges[index];
                 if(
-                    !edge->vertical ||
-                    edge->x != canvas_w ||
-                    edge->marker == marker
+                    !edge.vertical() ||
+                    edge.x != canvas_w ||
+                    edge.marker() == marker
                 ) continue;
-                edge->marker = marker;
-                edge_clip(*edge, right_edges);
-                tmp.push_back(edge);
+                edge.set_marker(marker);
+                edge_clip(edge, right_edges);
+                tmp.push_back(index);
             }
         }
 
-        right_edges.push_back({canvas_w, 0, w-canvas_w, false, true, marker});
-        right_edges.push_back({w, 0, h, true, false, marker});
+        right_edges.push_back(make_edge(canvas_w, 0, w-canvas_w, false, true));
+        right_edges.push_back(make_edge(w, 0, h, true, false));
         if(h <= canvas_h)
             right_edges.push_back(
-                {canvas_w, h, w-canvas_w, false, false, marker}
+                make_edge(canvas_w, h, w-canvas_w, false, false)
             );
     }
 
-    std::sort(tmp.begin(), tmp.end());
-    free_edge* base = edges.data();
-    for(free_edge* edge: tmp)
+    top_edges.insert(top_edges.end(), right_edges.begin(), right_edges.end());
+
+    // The cell size is only changed once the automatic one has grown well
+    // past it, so that a canvas grown in many small steps rebuilds the lookup
+    // only a logarithmic number of times. The same goes for the lower bound
+    // that keeps the lookup small, which also applies to a set cell size.
+    // Otherwise, the grid is kept and only the replaced border edges are
+    // updated in it.
+    int min_size = min_cell_size(w, h);
+    int ideal_cell_size = std::max(
+        get_cell_size(std::uint64_t(w)*h, get_mean_rect_size()), min_size
+    );
+    // A set cell size can be anything, so it's compared in 64 bits.
+    std::int64_t limit = std::int64_t(cell_size) * 3;
+    bool rebuild = min_size * 2 > limit || (
+        !fixed_cell_size && ideal_cell_size * 2 > limit
+    );
+    if(!rebuild)
     {
-        edges.erase(edges.begin()+(edge-base));
-        base++;
+        for(edge_index index: tmp)
+            unlink_edge(index);
     }
 
-    edges.insert(edges.end(), top_edges.begin(), top_edges.end());
-    edges.insert(edges.end(), right_edges.begin(), right_edges.end());
-
+    // Replaced edges' slots are reused for the new edges, any leftover slots
+    // are filled from the end.
+    std::sort(tmp.begin(), tmp.end());
+    size_t reused = std::min(tmp.size(), top_edges.size());
+    size_t first_new = edges.size();
+    for(size_t i = 0; i < reused; ++i)
+        edges[tmp[i]] = top_edges[i];
+    edges.insert(edges.end(), top_edges.begin() + reused, top_edges.end());
+
+    // The new borders continue the old ones.
+    int old_w = canvas_w;
+    int old_h = canvas_h;
     canvas_h = h;
     canvas_w = w;
 
-    set_cell_size();
+    update_open();
+
+    if(rebuild)
+    {
+        for(size_t i = tmp.size(); i > reused; --i)
+            remove_edge(tmp[i-1], false);
+        coalesce_edges({0, old_w, w}, {0, old_h, h}, false);
+        set_cell_size(fixed_cell_size ? cell_size : -1);
+        return;
+    }
+
+    // Cells keep their coordinates, so their pages only need to be moved to
+    // their new indices.
+    resize_lookup(true);
+
+    for(size_t i = 0; i < reused; ++i)
+        link_edge(tmp[i]);
+    for(size_t i = first_new; i < edges.size(); ++i)
+        link_edge(i);
+
+    // Descending, so that the last edge is never one that is still waiting
+    // to be removed.
+    for(size_t i = tmp.size(); i > reused; --i)
+        remove_edge(tmp[i-1], true);
+
+    coalesce_edges({0, old_w, w}, {0, old_h, h}, true);
 }
 
-void rect_packer::reset(int w, int h)
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::reset(int w, int h)
 {
-    canvas_w = w;
-    canvas_h = h;
-    lookup_w = (canvas_w+cell_size-1)/cell_size;
-    lookup_h = (canvas_h+cell_size-1)/cell_size;
+    canvas_w = std::min(w, get_max_size());
+    canvas_h = std::min(h, get_max_size());
+    update_open();
     reset();
 }
 
-void rect_packer::reset()
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::reset()
 {
-    edge_lookup.resize(lookup_w*lookup_h);
-    for(auto& cell: edge_lookup)
-        cell.clear();
+    resize_lookup(false);
 
     edges.clear();
-    edges.push_back({0, 0, canvas_h, true, true, marker});
-    edges.push_back({0, 0, canvas_w, false, true, marker});
-    edges.push_back({canvas_w, 0, canvas_h, true, false, marker});
-    edges.push_back({0, canvas_h, canvas_w, false, false, marker});
+    edges.push_back(make_edge(0, 0, canvas_h, true, true));
+    edges.push_back(make_edge(0, 0, canvas_w, false, true));
+    edges.push_back(make_edge(canvas_w, 0, canvas_h, true, false));
+    edges.push_back(make_edge(0, canvas_h, canvas_w, false, false));
     recalc_edge_lookup();
 }
 
-void rect_packer::set_cell_size(int cell_size)
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::set_cell_size(int cell_size)
 {
-    if(cell_size < 1) cell_size = get_cell_size(canvas_w*canvas_h);
+    fixed_cell_size = cell_size >= 1;
+    if(cell_size < 1)
+    {
+        cell_size = get_cell_size(
+            std::uint64_t(canvas_w)*canvas_h, get_mean_rect_size()
+        );
+    }
     this->cell_size = cell_size;
 
-    lookup_h = (canvas_h+cell_size-1)/cell_size;
-    lookup_w = (canvas_w+cell_size-1)/cell_size;
+    resize_lookup(false);
+    recalc_edge_lookup();
+}
 
-    edge_lookup.resize(lookup_w*lookup_h);
-    for(auto& cell: edge_lookup)
-        cell.clear();
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::set_open(bool open)
+{
+    open_setting = open;
+    update_open();
+}
 
-    recalc_edge_lookup();
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::set_corner_search(bool corner, int refine)
+{
+    corner_search = corner;
+    refine_edges = refine;
 }
 
-void rect_packer::set_open(bool open)
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::set_block_runs(bool block_runs)
 {
-    this->open = open;
+    this->block_runs = block_runs;
 }
 
-bool rect_packer::pack(int w, int h, int& x, int& y)
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::set_growth(const growth_policy& policy)
 {
-    std::vector<free_edge*> affected;
+    growth = policy;
+    growth.max_w = std::min(growth.max_w, get_max_size());
+    growth.max_h = std::min(growth.max_h, get_max_size());
+    // The aspect ratio is compared on a log scale, so it must be positive.
+    if(!(growth.aspect > 0)) growth.aspect = 1.0f;
+    update_open();
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::get_config_key(
+    std::vector<std::uint32_t>& key
+) const {
+    std::uint32_t aspect;
+    static_assert(sizeof(aspect) == sizeof(growth.aspect), "");
+    memcpy(&aspect, &growth.aspect, sizeof(aspect));
+    key.insert(key.end(), {
+        rect_packer_algorithm_version,
+        cell_size_table_id,
+        std::uint32_t(sizeof(T)), O::key(), R::key(), S::key(),
+        std::uint32_t(canvas_w), std::uint32_t(canvas_h),
+        std::uint32_t(open_setting),
+        std::uint32_t(growth.max_w), std::uint32_t(growth.max_h),
+        std::uint32_t(growth.power_of_two), std::uint32_t(growth.step),
+        aspect,
+        std::uint32_t(corner_search), std::uint32_t(refine_edges),
+        std::uint32_t(block_runs),
+        std::uint32_t(cell_size), std::uint32_t(fixed_cell_size),
+        std::uint32_t(rect_size_sum), std::uint32_t(rect_size_sum >> 32),
+        std::uint32_t(rect_size_count), std::uint32_t(rect_size_count >> 32)
+    });
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::get_max_size()
+{
+    // The edges on the far sides of the canvas are at x == w and y == h, so
+    // the size itself must fit in T.
+    return int(std::min<long long>(
+        std::numeric_limits<T>::max(), (1 << 29) - 1
+    ));
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::get_width() const
+{
+    return canvas_w;
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::get_height() const
+{
+    return canvas_h;
+}
+
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::pack(int w, int h, int& x, int& y)
+{
+    RECT_PACKER_STAT(stat_timer timer(nullptr, &stats.pack);)
+    if(w > get_max_size() || h > get_max_size()) return false;
+    track_rect_size(w, h);
+    std::vector<edge_index> affected;
 
     int score = 0;
     score = find_max_score(w, h, x, y, affected);
+    // Each growth should be enough, but the loop guards against a search
+    // that still misses the spot; every round grows the canvas.
+    while(score == 0 && grow_to_fit(w, h, false))
+        score = find_max_score(w, h, x, y, affected);
 
     // No fit, fail.
     if(score == 0) return false;
@@ -186,24 +615,35 @@ bool rect_packer::pack(int w, int h, int& x, int& y)
     return true;
 }
 
-bool rect_packer::pack_rotate(int w, int h, int& x, int& y, bool& rotated)
-{
-    // Fast path if we rotation is meaningless.
-    if(w == h)
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::pack_rotate(
+    int w, int h, int& x, int& y, bool& rotated
+){
+    RECT_PACKER_STAT(stat_timer timer(nullptr, &stats.pack_rotate);)
+    if(w > get_max_size() || h > get_max_size()) return false;
+    // Fast path if we rotation is meaningless or disabled.
+    if(w == h || !R::allow(true))
     {
         rotated = false;
         return pack(w, h, x, y);
     }
 
+    track_rect_size(w, h);
+
     // Try both orientations.
     int rot_x, rot_y;
-    std::vector<free_edge*> affected, rot_affected;
+    std::vector<edge_index> affected, rot_affected;
     int score = 0;
     int rot_score = 0;
 
     score = find_max_score(w, h, x, y, affected);
     rot_score = find_max_score(h, w, rot_x, rot_y, rot_affected);
-    if(score == 0 && rot_score == 0) return false;
+    while(score == 0 && rot_score == 0)
+    {
+        if(!grow_to_fit(w, h, true)) return false;
+        score = find_max_score(w, h, x, y, affected);
+        rot_score = find_max_score(h, w, rot_x, rot_y, rot_affected);
+    }
 
     // Pick better orientation, preferring non-rotated version.
     if(score >= rot_score)
@@ -221,162 +661,1032 @@ bool rect_packer::pack_rotate(int w, int h, int& x, int& y, bool& rotated)
     return true;
 }
 
-int rect_packer::pack(rect* rects, size_t count, bool allow_rotation)
-{
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::pack(
+    rect* rects, size_t count, bool allow_rotation
+){
+    RECT_PACKER_STAT(stat_timer timer(nullptr, &stats.pack_batch);)
     int packed = 0;
+    tune_cell_size(rects, count);
 
     std::vector<rect*> rr;
-    rr.resize(count);
-    for(unsigned i = 0; i < count; ++i)
     {
-        rr[i] = rects + i;
-        rr[i]->rotated = false;
+        RECT_PACKER_TRACE_EVENT(
+            pack_trace::scope trace_scope(trace, "sort", -1, -1, count);
+        )
+        sort_batch(rects, count, rr);
+    }
+
+    for(size_t i = 0; i < rr.size();)
+        i = pack_batch_step(rr, i, allow_rotation, packed);
+    return packed;
+}
+
+template<typename T, typename O, typename R, typename S>
+basic_rect_packer<T, O, R, S>::batch_job::batch_job(
+    basic_rect_packer& packer, rect* rects, size_t count,
+    bool allow_rotation, const std::atomic<bool>* cancel
+): packer(&packer), next(0), packed(0), allow_rotation(allow_rotation),
+   cancel(cancel), was_cancelled(false)
+{
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(packer.trace, "sort", -1, -1, count);
+    )
+    packer.tune_cell_size(rects, count);
+    packer.sort_batch(rects, count, order);
+}
+
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::batch_job::step(
+    std::chrono::nanoseconds time_budget
+){
+    typedef std::chrono::steady_clock clock;
+    clock::time_point end = clock::now() + time_budget;
+    while(!done())
+    {
+        if(cancel && cancel->load(std::memory_order_relaxed))
+        {
+            was_cancelled = true;
+            break;
+        }
+
+        next = packer->pack_batch_step(order, next, allow_rotation, packed);
+
+        if(clock::now() >= end) break;
+    }
+    return done();
+}
+
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::batch_job::done() const
+{
+    return was_cancelled || next == order.size();
+}
+
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::batch_job::cancelled() const
+{
+    return was_cancelled;
+}
+
+template<typename T, typename O, typename R, typename S>
+size_t basic_rect_packer<T, O, R, S>::batch_job::get_progress() const
+{
+    return next;
+}
+
+template<typename T, typename O, typename R, typename S>
+size_t basic_rect_packer<T, O, R, S>::batch_job::get_count() const
+{
+    return order.size();
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::batch_job::get_packed() const
+{
+    return packed;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::sort_batch(
+    rect* rects, size_t count, std::vector<rect*>& order
+) const {
+    order.resize(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        order[i] = rects + i;
+        order[i]->rotated = false;
+    }
+    sort_order(order);
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::sort_order(
+    std::vector<rect*>& order
+) const {
+    if(block_runs)
+    {
+        std::sort(
+            order.begin(),
+            order.end(),
+            [](const rect* a, const rect* b){
+                int a_max = std::max(a->w, a->h), b_max = std::max(b->w, b->h);
+                if(a_max != b_max) return a_max > b_max;
+                int a_min = std::min(a->w, a->h), b_min = std::min(b->w, b->h);
+                if(a_min != b_min) return a_min > b_min;
+                return a->w > b->w;
+            }
+        );
+        return;
     }
 
     std::sort(
-        rr.begin(),
-        rr.end(),
+        order.begin(),
+        order.end(),
         [](const rect* a, const rect* b){
             return std::max(a->w, a->h) > std::max(b->w, b->h);
         }
     );
+}
 
-    for(rect* r: rr)
+template<typename T, typename O, typename R, typename S>
+size_t basic_rect_packer<T, O, R, S>::pack_batch_step(
+    const std::vector<rect*>& order, size_t next, bool allow_rotation,
+    int& packed
+){
+    size_t run = 1;
+    if(block_runs && !order[next]->packed)
     {
-        if(r->packed)
-        {
+        const rect& first = *order[next];
+        while(
+            next + run < order.size() &&
+            !order[next + run]->packed &&
+            order[next + run]->w == first.w &&
+            order[next + run]->h == first.h
+        ) run++;
+    }
+
+    size_t done = 0;
+    if(run >= size_t(min_block_run))
+    {
+        done = pack_block_run(&order[next], run, allow_rotation);
+        packed += done;
+    }
+
+    for(size_t i = next + done; i < next + run; ++i)
+    {
+        if(pack_batch_rect(*order[i], allow_rotation))
             packed++;
-            continue;
-        }
+    }
+    return next + run;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::tune_cell_size(
+    const rect* rects, size_t count
+){
+    if(fixed_cell_size) return;
+
+    // The batch is counted as it gets packed, so it's only added to a copy
+    // here.
+    std::uint64_t sum = rect_size_sum, n = rect_size_count;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(rects[i].packed) continue;
+        sum += std::uint64_t(std::max(rects[i].w, 0)) + std::max(rects[i].h, 0);
+        n++;
+    }
+    if(n == rect_size_count) return;
+
+    int ideal_cell_size = std::max(
+        get_cell_size(std::uint64_t(canvas_w)*canvas_h, sum / (2.0 * n)),
+        min_cell_size(canvas_w, canvas_h)
+    );
+    if(
+        ideal_cell_size * 2 > cell_size * 3 ||
+        cell_size * 2 > ideal_cell_size * 3
+    ){
+        cell_size = ideal_cell_size;
+        resize_lookup(false);
+        recalc_edge_lookup();
+    }
+}
 
-        if(allow_rotation)
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::track_rect_size(
+    int w, int h, std::uint64_t count
+){
+    rect_size_sum += (std::uint64_t(std::max(w, 0)) + std::max(h, 0)) * count;
+    rect_size_count += count;
+}
+
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::pack_batch_rect(
+    rect& r, bool allow_rotation
+){
+    if(r.packed) return true;
+
+    if(R::allow(allow_rotation))
+        r.packed = pack_rotate(r.w, r.h, r.x, r.y, r.rotated);
+    else r.packed = pack(r.w, r.h, r.x, r.y);
+    return r.packed;
+}
+
+template<typename T, typename O, typename R, typename S>
+size_t basic_rect_packer<T, O, R, S>::pack_block_run(
+    rect* const* run, size_t count, bool allow_rotation
+){
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(
+            trace, "pack_block_run", run[0]->w, run[0]->h, count
+        );
+    )
+    int w = run[0]->w, h = run[0]->h;
+    if(w <= 0 || h <= 0) return 0;
+    bool rotation = R::allow(allow_rotation) && w != h;
+
+    std::vector<edge_index> affected, rot_affected;
+    size_t done = 0;
+    while(count - done >= size_t(min_block_run))
+    {
+        // Start from a roughly square block of k columns and m full rows.
+        size_t left = count - done;
+        int k = std::max(int(std::lround(std::sqrt(left * h / double(w)))), 1);
+        k = std::min(k, int(std::min(left, size_t(canvas_w / w))));
+        int m = k > 0 ? std::min(int(left / k), canvas_h / h) : 0;
+
+        bool placed = false;
+        while(k * m >= min_block_run)
         {
-            if(pack_rotate(r->w, r->h, r->x, r->y, r->rotated))
+            int x = 0, y = 0, rot_x = 0, rot_y = 0;
+            int score = find_max_score(k * w, m * h, x, y, affected);
+            int rot_score = rotation ? find_max_score(
+                m * h, k * w, rot_x, rot_y, rot_affected
+            ) : 0;
+
+            if(score > 0 || rot_score > 0)
             {
-                r->packed = true;
-                packed++;
+                // Like pack_rotate(), the unrotated block wins ties. A
+                // rotated block has the rects rotated and transposed.
+                bool rotated = score < rot_score;
+                if(rotated)
+                    place_rect(rot_x, rot_y, m * h, k * w, rot_affected);
+                else place_rect(x, y, k * w, m * h, affected);
+
+                for(int row = 0; row < m; ++row)
+                for(int col = 0; col < k; ++col)
+                {
+                    rect& r = *run[done++];
+                    r.packed = true;
+                    r.rotated = rotated;
+                    r.x = rotated ? rot_x + row * h : x + col * w;
+                    r.y = rotated ? rot_y + col * w : y + row * h;
+                }
+                track_rect_size(w, h, k * m);
+                placed = true;
+                break;
             }
+
+            if(k > m) k = (k + 1) / 2;
+            else m = (m + 1) / 2;
+        }
+        if(!placed) break;
+    }
+    return done;
+}
+
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::place_fixed(const rect* rects, size_t count)
+{
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(trace, "place_fixed", -1, -1, count);
+    )
+    std::vector<box> boxes(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        const rect& r = rects[i];
+        boxes[i] = r.rotated ?
+            box{r.x, r.y, r.h, r.w} : box{r.x, r.y, r.w, r.h};
+        const box& b = boxes[i];
+        if(!is_free(b.x, b.y, b.w, b.h)) return false;
+    }
+    if(boxes_overlap(boxes, cell_size)) return false;
+
+    // The new rects only change the boundary on the lines their sides are
+    // on. Existing edges on those lines are swept together with the sides,
+    // the rest are kept as they are. Since the rects are in free space, an
+    // existing edge and a side at the same spot always face each other, and
+    // cancel out.
+    line_set vertical_lines(count * 2), horizontal_lines(count * 2);
+    std::vector<boundary_span> vertical_spans, horizontal_spans;
+    vertical_spans.reserve(count * 2);
+    horizontal_spans.reserve(count * 2);
+    for(const box& b: boxes)
+    {
+        vertical_lines.insert(b.x);
+        vertical_lines.insert(b.x + b.w);
+        horizontal_lines.insert(b.y);
+        horizontal_lines.insert(b.y + b.h);
+        vertical_spans.push_back({b.x, b.y, b.y + b.h, false});
+        vertical_spans.push_back({b.x + b.w, b.y, b.y + b.h, true});
+        horizontal_spans.push_back({b.y, b.x, b.x + b.w, false});
+        horizontal_spans.push_back({b.y + b.h, b.x, b.x + b.w, true});
+    }
+
+    std::vector<free_edge> kept;
+    kept.reserve(edges.size());
+    for(const free_edge& edge: edges)
+    {
+        // An up/right inside edge has the occupied side on the left or below.
+        if(edge.vertical() && vertical_lines.find(edge.x) >= 0)
+        {
+            vertical_spans.push_back({
+                edge.x, edge.y, edge.y + edge.length, edge.up_right_inside()
+            });
+        }
+        else if(!edge.vertical() && horizontal_lines.find(edge.y) >= 0)
+        {
+            horizontal_spans.push_back({
+                edge.y, edge.x, edge.x + edge.length, edge.up_right_inside()
+            });
+        }
+        else kept.push_back(edge);
+    }
+
+    edges.swap(kept);
+    sweep_boundaries(
+        vertical_spans, vertical_lines,
+        [&](int line, int start, int length, bool inside){
+            edges.push_back(make_edge(line, start, length, true, inside));
+        }
+    );
+    sweep_boundaries(
+        horizontal_spans, horizontal_lines,
+        [&](int line, int start, int length, bool inside){
+            edges.push_back(make_edge(start, line, length, false, inside));
+        }
+    );
+
+    recalc_edge_lookup();
+    return true;
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::repack(
+    const rect* prev, size_t prev_count, rect* rects, size_t count,
+    bool allow_rotation
+){
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(trace, "repack", -1, -1, count);
+    )
+    std::vector<rect> kept;
+    std::vector<rect*> order;
+    for(size_t i = 0; i < count; ++i)
+    {
+        rect& r = rects[i];
+        if(
+            i < prev_count && prev[i].packed &&
+            prev[i].w == r.w && prev[i].h == r.h
+        ){
+            r.x = prev[i].x;
+            r.y = prev[i].y;
+            r.rotated = prev[i].rotated;
+            r.packed = true;
+            kept.push_back(r);
         }
         else
         {
-            if(pack(r->w, r->h, r->x, r->y))
-            {
-                r->packed = true;
-                packed++;
-            }
+            r.packed = false;
+            r.rotated = false;
+            order.push_back(&r);
         }
     }
+
+    reset();
+    int packed = 0;
+    if(place_fixed(kept.data(), kept.size()))
+    {
+        packed = kept.size();
+        sort_order(order);
+        for(size_t i = 0; i < order.size();)
+            i = pack_batch_step(order, i, allow_rotation, packed);
+        if(packed == int(count)) return packed;
+    }
+
+    // The kept placements are in the way (or didn't fit the canvas at all),
+    // so try without them.
+    std::vector<rect> partial(rects, rects + count);
+    reset();
+    for(size_t i = 0; i < count; ++i) rects[i].packed = false;
+    int full = pack(rects, count, allow_rotation);
+    if(full >= packed) return full;
+
+    std::copy(partial.begin(), partial.end(), rects);
+    kept.clear();
+    for(size_t i = 0; i < count; ++i)
+        if(rects[i].packed) kept.push_back(rects[i]);
+    reset();
+    place_fixed(kept.data(), kept.size());
     return packed;
 }
 
-void rect_packer::recalc_edge_lookup()
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::is_free(int x, int y, int w, int h) const
+{
+    if(
+        w <= 0 || h <= 0 || x < 0 || y < 0 ||
+        w > canvas_w - x || h > canvas_h - y
+    ) return false;
+
+    // No free edge may cross the area, so it's either completely free or
+    // completely occupied.
+    int sx = x/cell_size;
+    int sy = y/cell_size;
+    int ex = (x+w-1)/cell_size;
+    int ey = (y+h-1)/cell_size;
+    for(int cy = sy; cy <= ey; ++cy)
+    for(int cx = sx; cx <= ex; ++cx)
+    {
+        const cell_page* page = find_page(cx, cy);
+        if(!page) continue;
+        for(edge_index index: page->cells[cell_in_page(cx, cy)])
+        {
+            if(score_rect_edge(x, y, w, h, edges[index]) == -1)
+                return false;
+        }
+    }
+
+    // Cast a ray left from the corner pixel. The nearest vertical edge it
+    // hits tells which side is free. Missing all of them means that the ray
+    // started in an occupied area touching the left border.
+    int nearest_x = -1;
+    bool free = false;
+    for(int cx = sx; cx >= 0; --cx)
+    {
+        const cell_page* page = find_page(cx, sy);
+        if(!page) continue;
+        for(edge_index index: page->cells[cell_in_page(cx, sy)])
+        {
+            const free_edge& edge = edges[index];
+            if(
+                !edge.vertical() || edge.x > x || edge.x <= nearest_x ||
+                edge.y > y || edge.y + edge.length <= y
+            ) continue;
+            nearest_x = edge.x;
+            free = edge.up_right_inside();
+        }
+        if(nearest_x >= cx * cell_size) break;
+    }
+    return free;
+}
+
+template<typename T, typename O, typename R, typename S>
+const rect_packer_stats& basic_rect_packer<T, O, R, S>::get_stats() const
+{
+    return stats;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::reset_stats()
+{
+    stats = rect_packer_stats();
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::set_trace(pack_trace* trace)
+{
+    this->trace = trace;
+}
+
+template<typename T, typename O, typename R, typename S>
+size_t basic_rect_packer<T, O, R, S>::get_edge_count() const
+{
+    return edges.size();
+}
+
+template<typename T, typename O, typename R, typename S>
+typename basic_rect_packer<T, O, R, S>::edge_info
+basic_rect_packer<T, O, R, S>::get_edge(size_t index) const
+{
+    const free_edge& edge = edges[index];
+    return {
+        edge.x, edge.y, edge.length, edge.vertical(), edge.up_right_inside()
+    };
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::get_lookup_cell_size() const
+{
+    return cell_size;
+}
+
+template<typename T, typename O, typename R, typename S>
+double basic_rect_packer<T, O, R, S>::get_mean_rect_size() const
+{
+    return rect_size_count ? rect_size_sum / (2.0 * rect_size_count) : 0;
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::get_lookup_width() const
+{
+    return lookup_w;
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::get_lookup_height() const
+{
+    return lookup_h;
+}
+
+template<typename T, typename O, typename R, typename S>
+size_t basic_rect_packer<T, O, R, S>::get_cell_edge_count(
+    int cx, int cy
+) const {
+    const cell_page* page = find_page(cx, cy);
+    return page ? page->cells[cell_in_page(cx, cy)].size() : 0;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::set_count_visits(bool count)
+{
+    count_visits = count;
+    if(!count) return;
+    for_each_page([](cell_page& page){
+        std::fill(page.visits, page.visits + page_size*page_size, 0);
+    });
+}
+
+template<typename T, typename O, typename R, typename S>
+std::uint32_t basic_rect_packer<T, O, R, S>::get_cell_visits(
+    int cx, int cy
+) const {
+    if(!count_visits) return 0;
+    const cell_page* page = find_page(cx, cy);
+    return page ? page->visits[cell_in_page(cx, cy)] : 0;
+}
+
+template<typename T, typename O, typename R, typename S>
+typename basic_rect_packer<T, O, R, S>::free_edge
+basic_rect_packer<T, O, R, S>::make_edge(
+    int x, int y, int length, bool vertical, bool up_right_inside
+) const {
+    free_edge edge;
+    edge.x = T(x);
+    edge.y = T(y);
+    edge.length = T(length);
+    edge.bits = flag_type((vertical ? 1 : 0) | (up_right_inside ? 2 : 0));
+    edge.set_marker(marker);
+    return edge;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::next_marker()
+{
+    if(marker == max_marker)
+    {
+        for(free_edge& edge: edges)
+            edge.set_marker(0);
+        marker = 0;
+    }
+    marker++;
+}
+
+template<typename T, typename O, typename R, typename S>
+typename basic_rect_packer<T, O, R, S>::cell_page*
+basic_rect_packer<T, O, R, S>::find_page(int cx, int cy) const
+{
+    int px = cx >> page_shift, py = cy >> page_shift;
+    const page_block* block = page_blocks[
+        size_t(py >> page_shift) * blocks_w + (px >> page_shift)
+    ].get();
+    return block ? block->pages[cell_in_page(px, py)].get() : nullptr;
+}
+
+template<typename T, typename O, typename R, typename S>
+typename basic_rect_packer<T, O, R, S>::cell_page&
+basic_rect_packer<T, O, R, S>::get_page(int cx, int cy)
+{
+    int px = cx >> page_shift, py = cy >> page_shift;
+    std::unique_ptr<page_block>& block = page_blocks[
+        size_t(py >> page_shift) * blocks_w + (px >> page_shift)
+    ];
+    if(!block) block.reset(new page_block());
+    std::unique_ptr<cell_page>& page = block->pages[cell_in_page(px, py)];
+    if(!page) page.reset(new cell_page());
+    return *page;
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::cell_in_page(int cx, int cy)
+{
+    return (cy & (page_size-1)) << page_shift | (cx & (page_size-1));
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::min_cell_size(int w, int h)
+{
+    return (std::max(w, h) + max_lookup_size - 1) / max_lookup_size;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::resize_lookup(bool keep)
+{
+    if(!keep)
+    {
+        cell_size = std::max(cell_size, min_cell_size(canvas_w, canvas_h));
+        page_blocks.clear();
+    }
+
+    // The sizes are at most get_max_size(), but the sums are done in 64 bits
+    // anyway so that they can't overflow.
+    auto cells = [](std::int64_t size, std::int64_t cell){
+        return int((size + cell - 1) / cell);
+    };
+    int new_lookup_w = cells(canvas_w, cell_size);
+    int new_lookup_h = cells(canvas_h, cell_size);
+    int new_blocks_w = cells(new_lookup_w, page_size * page_size);
+    int new_blocks_h = cells(new_lookup_h, page_size * page_size);
+
+    if(keep && new_blocks_w != blocks_w)
+    {
+        std::vector<std::unique_ptr<page_block>> grown(
+            size_t(new_blocks_w) * new_blocks_h
+        );
+        for(int by = 0; by < blocks_h; ++by)
+        for(int bx = 0; bx < blocks_w; ++bx)
+        {
+            grown[size_t(by) * new_blocks_w + bx] =
+                std::move(page_blocks[size_t(by) * blocks_w + bx]);
+        }
+        page_blocks.swap(grown);
+    }
+    page_blocks.resize(size_t(new_blocks_w) * new_blocks_h);
+
+    lookup_w = new_lookup_w;
+    lookup_h = new_lookup_h;
+    blocks_w = new_blocks_w;
+    blocks_h = new_blocks_h;
+}
+
+template<typename T, typename O, typename R, typename S>
+template<typename F>
+void basic_rect_packer<T, O, R, S>::for_each_page(F&& f)
 {
+    for(std::unique_ptr<page_block>& block: page_blocks)
+    {
+        if(!block) continue;
+        for(std::unique_ptr<cell_page>& page: block->pages)
+            if(page) f(*page);
+    }
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::recalc_edge_lookup()
+{
+    RECT_PACKER_STAT(stat_timer timer(&stats.recalc_edge_lookup_ns);)
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(
+            trace, "recalc_edge_lookup", -1, -1, edges.size()
+        );
+    )
     marker = 0;
 
-    // Clear lookup
-    for(auto& cell: edge_lookup)
-        cell.clear();
+    // Clear lookup, keeping the pages for reuse.
+    for_each_page([](cell_page& page){
+        for(std::vector<edge_index>& cell: page.cells)
+            cell.clear();
+    });
 
     // Rasterize edges on the lookup
-    for(auto& edge: edges)
+    for(edge_index i = 0; i < edges.size(); ++i)
     {
-        edge.marker = 0;
+        edges[i].set_marker(0);
+        link_edge(i);
+    }
+}
 
-        int sx = edge.x/cell_size;
-        int bx = edge.x%cell_size;
-        int sy = edge.y/cell_size;
-        int by = edge.y%cell_size;
+template<typename T, typename O, typename R, typename S>
+template<typename F>
+void basic_rect_packer<T, O, R, S>::for_each_edge_cell(
+    const free_edge& edge, F&& f
+){
+    int sx = edge.x/cell_size;
+    int bx = edge.x%cell_size;
+    int sy = edge.y/cell_size;
+    int by = edge.y%cell_size;
 
-        if(edge.vertical)
+    // Edges on a cell border are in the cells on both sides.
+    if(edge.vertical())
+    {
+        int ey = (edge.y+edge.length-1)/cell_size;
+        bool border = bx == 0 && sx > 0;
+
+        for(; sy <= ey; ++sy)
         {
-            int ey = (edge.y+edge.length-1)/cell_size;
-            bool border = bx == 0 && sx > 0;
+            if(sx < lookup_w) f(sx, sy);
+            if(border) f(sx-1, sy);
+        }
+    }
+    else
+    {
+        int ex = (edge.x+edge.length-1)/cell_size;
+        bool border = by == 0 && sy > 0;
 
-            for(; sy <= ey; ++sy)
+        for(; sx <= ex; ++sx)
+        {
+            if(sy < lookup_h) f(sx, sy);
+            if(border) f(sx, sy-1);
+        }
+    }
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::link_edge(edge_index index)
+{
+    for_each_edge_cell(edges[index], [this, index](int cx, int cy){
+        get_page(cx, cy).cells[cell_in_page(cx, cy)].push_back(index);
+    });
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::unlink_edge(edge_index index)
+{
+    for_each_edge_cell(edges[index], [this, index](int cx, int cy){
+        cell_page* page = find_page(cx, cy);
+        if(!page) return;
+        std::vector<edge_index>& cell = page->cells[cell_in_page(cx, cy)];
+        auto it = std::find(cell.begin(), cell.end(), index);
+        if(it == cell.end()) return;
+        *it = cell.back();
+        cell.pop_back();
+    });
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::coalesce_edges(
+    std::initializer_list<int> vertical_lines,
+    std::initializer_list<int> horizontal_lines,
+    bool linked
+){
+    // Edges are described by the line they're on and where they start on
+    // it.
+    auto line_of = [](const free_edge& e){
+        return e.vertical() ? int(e.x) : int(e.y);
+    };
+    auto start_of = [](const free_edge& e){
+        return e.vertical() ? int(e.y) : int(e.x);
+    };
+
+    std::vector<edge_index> candidates;
+    for(edge_index i = 0; i < edges.size(); ++i)
+    {
+        const free_edge& e = edges[i];
+        std::initializer_list<int> lines =
+            e.vertical() ? vertical_lines : horizontal_lines;
+        if(std::find(lines.begin(), lines.end(), line_of(e)) != lines.end())
+            candidates.push_back(i);
+    }
+    if(candidates.size() < 2) return;
+
+    // Mergeable edges end up next to each other.
+    auto same_run = [&](const free_edge& a, const free_edge& b){
+        return a.vertical() == b.vertical() && line_of(a) == line_of(b) &&
+            a.up_right_inside() == b.up_right_inside();
+    };
+    std::sort(
+        candidates.begin(), candidates.end(),
+        [&](edge_index ia, edge_index ib){
+            const free_edge& a = edges[ia];
+            const free_edge& b = edges[ib];
+            if(a.vertical() != b.vertical()) return a.vertical();
+            if(line_of(a) != line_of(b)) return line_of(a) < line_of(b);
+            if(a.up_right_inside() != b.up_right_inside())
+                return a.up_right_inside();
+            return start_of(a) < start_of(b);
+        }
+    );
+
+    std::vector<edge_index> removed;
+    for(size_t i = 0; i < candidates.size();)
+    {
+        const free_edge& first = edges[candidates[i]];
+        int start = start_of(first);
+        int end = start + first.length;
+        edge_index target = candidates[i];
+
+        size_t j = i + 1;
+        for(; j < candidates.size(); ++j)
+        {
+            const free_edge& e = edges[candidates[j]];
+            if(!same_run(first, e) || start_of(e) != end) break;
+            end += e.length;
+            target = std::min(target, candidates[j]);
+        }
+
+        if(j > i + 1)
+        {
+            for(size_t k = i; k < j; ++k)
             {
-                if(sx < lookup_w)
-                    edge_lookup[sy * lookup_w + sx].push_back(&edge);
-                if(border)
-                    edge_lookup[sy * lookup_w + sx-1].push_back(&edge);
+                if(linked) unlink_edge(candidates[k]);
+                if(candidates[k] != target) removed.push_back(candidates[k]);
             }
+
+            free_edge& e = edges[target];
+            if(e.vertical()) e.y = T(start);
+            else e.x = T(start);
+            e.length = T(end - start);
+            if(linked) link_edge(target);
         }
-        else
-        {
-            int ex = (edge.x+edge.length-1)/cell_size;
-            bool border = by == 0 && sy > 0;
+        i = j;
+    }
 
-            for(; sx <= ex; ++sx)
+    if(linked)
+    {
+        // Descending, like in enlarge().
+        std::sort(removed.begin(), removed.end());
+        for(size_t i = removed.size(); i > 0; --i)
+            remove_edge(removed[i-1], true);
+    }
+    else
+    {
+        std::sort(removed.begin(), removed.end());
+        size_t next_removed = 0;
+        edge_index out = 0;
+        for(edge_index i = 0; i < edges.size(); ++i)
+        {
+            if(next_removed < removed.size() && removed[next_removed] == i)
             {
-                if(sy < lookup_h)
-                    edge_lookup[sy * lookup_w + sx].push_back(&edge);
-                if(border)
-                    edge_lookup[(sy-1) * lookup_w + sx].push_back(&edge);
+                next_removed++;
+                continue;
             }
+            edges[out++] = edges[i];
         }
+        edges.resize(out);
+    }
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::remove_edge(edge_index index, bool linked)
+{
+    edge_index last = edges.size() - 1;
+    if(index != last)
+    {
+        if(linked) unlink_edge(last);
+        edges[index] = edges[last];
+        if(linked) link_edge(index);
     }
+    edges.pop_back();
 }
 
-int rect_packer::find_max_score(
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::find_max_score(
     int w, int h, int& best_x, int& best_y,
-    std::vector<free_edge*>& best_affected_edges
+    std::vector<edge_index>& best_affected_edges
 ){
+    if(corner_search)
+        return find_corner_score(w, h, best_x, best_y, best_affected_edges);
+
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(
+            trace, "find_max_score", w, h, edges.size()
+        );
+    )
     int best_score = 0;
-    int ideal = (w + h) * 2;
-    for(free_edge& edge: edges)
+    int ideal = S::ideal_score(w, h);
+    for(const free_edge& edge: edges)
     {
-        if(edge.vertical)
+        search_edge(
+            edge, w, h, best_score, best_x, best_y, best_affected_edges
+        );
+        if(best_score == ideal) break;
+    }
+    RECT_PACKER_TRACE_EVENT(trace_scope.set_score(best_score);)
+    return best_score;
+}
+
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::find_corner_score(
+    int w, int h, int& best_x, int& best_y,
+    std::vector<edge_index>& best_affected_edges
+){
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(
+            trace, "find_corner_score", w, h, edges.size()
+        );
+    )
+    int best_score = 0;
+    int ideal = S::ideal_score(w, h);
+    corner_scores.clear();
+    for(edge_index i = 0; i < edges.size(); ++i)
+    {
+        RECT_PACKER_STAT(stats.edges_visited++;)
+        const free_edge& edge = edges[i];
+
+        // The rect is either aligned with the start or the end of the edge.
+        // Ends of edges shorter than the rect are the starts of their
+        // neighbours, so those are only tried once.
+        int along = edge.vertical() ? h : w;
+        int starts[2] = {0, edge.length - along};
+        int edge_score = 0;
+        for(int j = 0; j < (starts[1] > 0 ? 2 : 1); ++j)
         {
-            int x = edge.x;
-            if(!edge.up_right_inside) x -= w;
-            if(x < 0 || x + w > canvas_w) continue;
+            int x = edge.x, y = edge.y;
+            if(edge.vertical())
+            {
+                if(!edge.up_right_inside()) x -= w;
+                y += starts[j];
+            }
+            else
+            {
+                if(!edge.up_right_inside()) y -= h;
+                x += starts[j];
+            }
+            if(x < 0 || y < 0 || x + w > canvas_w || y + h > canvas_h)
+                continue;
+
+            // The skip isn't needed here.
+            int skip = edge.vertical();
+            int score = score_rect(x, y, w, h, skip, 0, tmp);
+            edge_score = std::max(edge_score, score);
+            if(score > best_score)
+            {
+                best_score = score;
+                best_x = x;
+                best_y = y;
+                best_affected_edges = tmp;
+            }
+        }
+        if(best_score == ideal) break;
+        corner_scores.push_back({edge_score, i});
+    }
 
-            int ey = std::min(edge.y + edge.length, canvas_h - h + 1);
+    // Some edges have a better spot somewhere in the middle, so the most
+    // promising ones are searched fully.
+    if(refine_edges > 0 && best_score != ideal)
+    {
+        size_t count = std::min(size_t(refine_edges), corner_scores.size());
+        std::partial_sort(
+            corner_scores.begin(), corner_scores.begin() + count,
+            corner_scores.end(),
+            [](
+                const std::pair<int, edge_index>& a,
+                const std::pair<int, edge_index>& b
+            ){ return a.first > b.first; }
+        );
+        for(size_t i = 0; i < count; ++i)
+        {
+            search_edge(
+                edges[corner_scores[i].second], w, h,
+                best_score, best_x, best_y, best_affected_edges
+            );
+            if(best_score == ideal) break;
+        }
+    }
+    RECT_PACKER_TRACE_EVENT(trace_scope.set_score(best_score);)
+    return best_score;
+}
 
-            for(int y = edge.y; y < ey;)
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::search_edge(
+    const free_edge& edge, int w, int h,
+    int& best_score, int& best_x, int& best_y,
+    std::vector<edge_index>& best_affected_edges
+){
+    RECT_PACKER_STAT(stats.edges_visited++;)
+    if(edge.vertical())
+    {
+        int x = edge.x;
+        if(!edge.up_right_inside()) x -= w;
+        if(x < 0 || x + w > canvas_w) return;
+
+        int ey = std::min(edge.y + edge.length, canvas_h - h + 1);
+
+        for(int y = edge.y; y < ey;)
+        {
+            int skip = edge.vertical();
+            int score = score_rect(x, y, w, h, skip, ey, tmp);
+            if(score > best_score)
             {
-                int skip = edge.vertical;
-                int score = score_rect(x, y, w, h, skip, ey, tmp);
-                if(score > best_score)
-                {
-                    best_score = score;
-                    best_x = x;
-                    best_y = y;
-                    best_affected_edges = tmp;
-                }
-                y += skip;
+                best_score = score;
+                best_x = x;
+                best_y = y;
+                best_affected_edges = tmp;
             }
+            RECT_PACKER_STAT(stats.skip_distance += skip;)
+            y += skip;
         }
-        else
-        {
-            int y = edge.y;
-            if(!edge.up_right_inside) y -= h;
-            if(y < 0 || y + h > canvas_h) continue;
+    }
+    else
+    {
+        int y = edge.y;
+        if(!edge.up_right_inside()) y -= h;
+        if(y < 0 || y + h > canvas_h) return;
 
-            int ex = std::min(edge.x + edge.length, canvas_w - w + 1);
+        int ex = std::min(edge.x + edge.length, canvas_w - w + 1);
 
-            for(int x = edge.x; x < ex;)
+        for(int x = edge.x; x < ex;)
+        {
+            int skip = edge.vertical();
+            int score = score_rect(x, y, w, h, skip, ex, tmp);
+            if(score > best_score)
             {
-                int skip = edge.vertical;
-                int score = score_rect(x, y, w, h, skip, ex, tmp);
-                if(score > best_score)
-                {
-                    best_score = score;
-                    best_x = x;
-                    best_y = y;
-                    best_affected_edges = tmp;
-                }
-                x += skip;
+                best_score = score;
+                best_x = x;
+                best_y = y;
+                best_affected_edges = tmp;
             }
+            RECT_PACKER_STAT(stats.skip_distance += skip;)
+            x += skip;
         }
-        if(best_score == ideal) break;
     }
-    return best_score;
 }
 
-int rect_packer::score_rect(
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::score_rect(
     int x, int y, int w, int h, int& skip, int end,
-    std::vector<free_edge*>& affected_edges
+    std::vector<edge_index>& affected_edges
 ){
+    RECT_PACKER_STAT(stats.score_rect_calls++;)
     affected_edges.clear();
 
     bool vertical = skip;
@@ -389,48 +1699,74 @@ int rect_packer::score_rect(
     if(vertical) end = std::min(end, (ey+1)*cell_size);
     else end = std::min(end, (ex+1)*cell_size);
 
-    marker++;
+    next_marker();
+
+    // Local copies, the compiler can't tell that writing the markers doesn't
+    // change these.
+    const flag_type cur_marker = marker;
+    free_edge* const edge_data = edges.data();
+    const bool visits = count_visits;
+
     for(int cy = sy; cy <= ey; ++cy)
     {
         for(int cx = sx; cx <= ex; ++cx)
         {
-            auto& cell = edge_lookup[cy * lookup_w + cx];
-            for(free_edge* edge: cell)
+            RECT_PACKER_STAT(stats.cells_scanned++;)
+            cell_page* page = find_page(cx, cy);
+            if(!page)
             {
-                if(edge->marker == marker) continue;
-                edge->marker = marker;
+                // Empty cells only need a page for counting visits.
+                if(!visits) continue;
+                page = &get_page(cx, cy);
+            }
+            int local = cell_in_page(cx, cy);
+            if(visits) page->visits[local]++;
+            for(edge_index index: page->cells[local])
+            {
+                free_edge& edge = edge_data[index];
+                if(edge.marker() == cur_marker) continue;
+                edge.set_marker(cur_marker);
 
                 int escore = score_rect_edge(x, y, w, h, edge); 
                 if(escore == -1)
                 {
-                    if(vertical) skip = edge->y + edge->length - y;
-                    else skip = edge->x + edge->length - x;
+                    if(vertical) skip = edge.y + edge.length - y;
+                    else skip = edge.x + edge.length - x;
+                    RECT_PACKER_STAT(stats.early_exits++;)
                     return 0;
                 }
 
                 if(escore > 0)
                 {
-                    affected_edges.push_back(edge);
-                    score += escore;
+                    // In open mode, the far borders of the canvas don't count
+                    // towards the score since they may move. They must still
+                    // be split like any other edge, or the parts behind placed
+                    // rects would later be mistaken for free space.
+                    bool open_border = O::is_open(open) && (
+                        edge.vertical() ?
+                        edge.x == canvas_w : edge.y == canvas_h
+                    );
+                    affected_edges.push_back(index);
+                    if(!open_border) score += S::edge_score(escore);
                 }
 
                 if(vertical)
                 {
-                    if(edge->vertical && edge->x == x + w && edge->y > y)
-                        end = std::min(end, edge->y);
+                    if(edge.vertical() && edge.x == x + w && edge.y > y)
+                        end = std::min(end, int(edge.y));
                     else if(
-                        !edge->vertical && edge->y > y + h &&
-                        edge->x < x + w && edge->x + edge->length > x
-                    ) end = std::min(end, edge->y - h);
+                        !edge.vertical() && edge.y > y + h &&
+                        edge.x < x + w && edge.x + edge.length > x
+                    ) end = std::min(end, edge.y - h);
                 }
                 else
                 {
-                    if(!edge->vertical && edge->y == y + h && edge->x > x)
-                        end = std::min(end, edge->x);
+                    if(!edge.vertical() && edge.y == y + h && edge.x > x)
+                        end = std::min(end, int(edge.x));
                     else if(
-                        edge->vertical && edge->x > x + w &&
-                        edge->y < y + h && edge->y + edge->length > y
-                    ) end = std::min(end, edge->x - w);
+                        edge.vertical() && edge.x > x + w &&
+                        edge.y < y + h && edge.y + edge.length > y
+                    ) end = std::min(end, edge.x - w);
                 }
             }
         }
@@ -445,145 +1781,276 @@ int rect_packer::score_rect(
     return score;
 }
 
-int rect_packer::score_rect_edge(
-    int x, int y, int w, int h, free_edge* edge
-){
-    if(edge->vertical)
+template<typename T, typename O, typename R, typename S>
+int basic_rect_packer<T, O, R, S>::score_rect_edge(
+    int x, int y, int w, int h, const free_edge& edge
+) const {
+    if(edge.vertical())
     {
-        int score = calc_overlap(y, h, edge->y, edge->length);
-        if(edge->x > x && edge->x < x + w && score > 0) return -1;
-        if(open && edge->x == canvas_w) return 0;
-        if(x == edge->x || x + w == edge->x) return score;
+        int score = calc_overlap(y, h, edge.y, edge.length);
+        if(edge.x > x && edge.x < x + w && score > 0) return -1;
+        if(x == edge.x || x + w == edge.x) return score;
     }
     else
     {
-        int score = calc_overlap(x, w, edge->x, edge->length);
-        if(edge->y > y && edge->y < y + h && score > 0) return -1;
-        if(open && edge->y == canvas_h) return 0;
-        if(y == edge->y || y + h == edge->y) return score;
+        int score = calc_overlap(x, w, edge.x, edge.length);
+        if(edge.y > y && edge.y < y + h && score > 0) return -1;
+        if(y == edge.y || y + h == edge.y) return score;
     }
     return -2;
 }
 
 // This function doesn't have to be super optimized in terms of allocations,
 // it's run only once when packing a rect.
-void rect_packer::place_rect(
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::place_rect(
     int x, int y, int w, int h,
-    std::vector<free_edge*>& affected_edges
+    std::vector<edge_index>& affected_edges
 ){
+    RECT_PACKER_STAT(stat_timer timer(&stats.place_rect_ns);)
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(trace, "place_rect", w, h, edges.size());
+    )
     std::vector<free_edge> new_edges;
-    std::vector<free_edge*> delete_edges;
+    std::vector<edge_index> delete_edges;
     std::vector<free_edge> vert_rect_edges;
     std::vector<free_edge> hori_rect_edges;
 
-    vert_rect_edges.push_back({x,y,h,true,false,marker});
-    vert_rect_edges.push_back({x+w,y,h,true,true,marker});
+    vert_rect_edges.push_back(make_edge(x,y,h,true,false));
+    vert_rect_edges.push_back(make_edge(x+w,y,h,true,true));
 
-    hori_rect_edges.push_back({x,y,w,false,false,marker});
-    hori_rect_edges.push_back({x,y+h,w,false,true,marker});
+    hori_rect_edges.push_back(make_edge(x,y,w,false,false));
+    hori_rect_edges.push_back(make_edge(x,y+h,w,false,true));
 
-    for(free_edge* edge: affected_edges)
+    for(edge_index index: affected_edges)
     {
-        free_edge a, b;
+        free_edge& edge = edges[index];
 
-        if(edge->vertical)
+        // Lengths are kept as int until they are known to be positive, T may
+        // be unsigned.
+        int ax, ay, a_length, bx, by, b_length;
+        if(edge.vertical())
         {
-            a = {
-                edge->x, edge->y, y - edge->y,
-                true, edge->up_right_inside, marker
-            };
-            b = {
-                edge->x, y + h, edge->y + edge->length - y - h,
-                true, edge->up_right_inside, marker
-            };
-            edge_clip(*edge, vert_rect_edges);
+            ax = edge.x; ay = edge.y; a_length = y - edge.y;
+            bx = edge.x; by = y + h; b_length = edge.y + edge.length - y - h;
+            edge_clip(edge, vert_rect_edges);
         }
         else
         {
-            a = {
-                edge->x, edge->y, x - edge->x,
-                false, edge->up_right_inside, marker
-            };
-            b = {
-                x + w, edge->y, edge->x + edge->length - x - w,
-                false, edge->up_right_inside, marker
-            };
-            edge_clip(*edge, hori_rect_edges);
+            ax = edge.x; ay = edge.y; a_length = x - edge.x;
+            bx = x + w; by = edge.y; b_length = edge.x + edge.length - x - w;
+            edge_clip(edge, hori_rect_edges);
         }
 
-        if(a.length > 0 && b.length > 0)
+        free_edge a = make_edge(
+            ax, ay, a_length, edge.vertical(), edge.up_right_inside()
+        );
+        free_edge b = make_edge(
+            bx, by, b_length, edge.vertical(), edge.up_right_inside()
+        );
+
+        if(a_length > 0 && b_length > 0)
         {
-            *edge = a;
+            edge = a;
             new_edges.push_back(b);
         }
-        else if(a.length > 0) *edge = a;
-        else if(b.length > 0) *edge = b;
-        else delete_edges.push_back(edge);
+        else if(a_length > 0) edge = a;
+        else if(b_length > 0) edge = b;
+        else delete_edges.push_back(index);
     }
 
     std::sort(delete_edges.begin(), delete_edges.end());
-    free_edge* base = edges.data();
-    for(free_edge* edge: delete_edges)
+    edge_index removed = 0;
+    for(edge_index index: delete_edges)
     {
-        edges.erase(edges.begin()+(edge-base));
-        base++;
+        edges.erase(edges.begin()+(index-removed));
+        removed++;
     }
 
     edges.insert(edges.end(), new_edges.begin(), new_edges.end());
     edges.insert(edges.end(), vert_rect_edges.begin(), vert_rect_edges.end());
     edges.insert(edges.end(), hori_rect_edges.begin(), hori_rect_edges.end());
 
+    // The rect's sides may continue existing edges.
+    coalesce_edges({x, x + w}, {y, y + h}, false);
+
     recalc_edge_lookup();
 }
 
-void rect_packer::edge_clip(
+template<typename T, typename O, typename R, typename S>
+bool basic_rect_packer<T, O, R, S>::grow_to_fit(
+    int w, int h, bool allow_rotation
+){
+    // Rounds a grown size up according to the policy, or returns 0 if it
+    // can't fit under max.
+    auto round_size = [&](int cur, int needed, int max){
+        if(needed <= cur) return cur;
+        if(needed > max) return 0;
+        if(growth.power_of_two)
+        {
+            int size = 1;
+            while(size < needed) size *= 2;
+            return std::min(size, max);
+        }
+        // In 64 bits, since the step can be anything up to INT_MAX.
+        std::int64_t step = std::max(growth.step, 1);
+        return int(std::min<std::int64_t>(
+            cur + (needed - cur + step - 1) / step * step, max
+        ));
+    };
+
+    // How deep the free space along the right (vertical) or top border is
+    // next to a rw*rh rect placed against it. Only the rest of the rect's
+    // width or height has to be grown. The free parts of the border are the
+    // border edges that are left, and the depth is found by bisecting with
+    // is_free(). The rect is lined up with the start of a free part, so it
+    // touches whatever ends the border there; open borders don't score, and
+    // a rect touching nothing else would never be found by the search.
+    auto border_depth = [&](bool vertical, int rw, int rh){
+        int line = vertical ? canvas_w : canvas_h;
+        int need = std::min(vertical ? rh : rw, vertical ? canvas_h : canvas_w);
+        int reach = std::min(vertical ? rw : rh, line);
+        int best = 0;
+        for(const free_edge& edge: edges)
+        {
+            if(
+                edge.vertical() != vertical ||
+                (vertical ? edge.x : edge.y) != line ||
+                edge.length < need
+            ) continue;
+
+            int start = vertical ? edge.y : edge.x;
+            int lo = best, hi = reach;
+            while(lo < hi)
+            {
+                int depth = (lo + hi + 1) / 2;
+                bool free = vertical ?
+                    is_free(line - depth, start, depth, need) :
+                    is_free(start, line - depth, need, depth);
+                if(free) lo = depth;
+                else hi = depth - 1;
+            }
+            best = lo;
+        }
+        return best;
+    };
+
+    // Growing by the missing part next to the deepest free spot along the
+    // right or top side leaves room for the rect, so each candidate is
+    // guaranteed to fit.
+    int best_w = 0, best_h = 0;
+    double best_aspect_error = 0;
+    auto try_size = [&](int nw, int nh){
+        if(nw == 0 || nh == 0) return;
+        double aspect_error = fabs(log(nw / (nh * (double)growth.aspect)));
+        if(
+            best_w == 0 || aspect_error < best_aspect_error ||
+            (
+                aspect_error == best_aspect_error &&
+                nw * (double)nh < best_w * (double)best_h
+            )
+        ){
+            best_w = nw;
+            best_h = nh;
+            best_aspect_error = aspect_error;
+        }
+    };
+
+    for(int rotation = 0; rotation < (allow_rotation ? 2 : 1); ++rotation)
+    {
+        int rw = rotation ? h : w;
+        int rh = rotation ? w : h;
+        try_size(
+            round_size(
+                canvas_w, canvas_w + rw - border_depth(true, rw, rh),
+                growth.max_w
+            ),
+            round_size(canvas_h, rh, growth.max_h)
+        );
+        try_size(
+            round_size(canvas_w, rw, growth.max_w),
+            round_size(
+                canvas_h, canvas_h + rh - border_depth(false, rw, rh),
+                growth.max_h
+            )
+        );
+    }
+
+    if(best_w == 0 || (best_w == canvas_w && best_h == canvas_h))
+        return false;
+    enlarge(best_w, best_h);
+    return true;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::update_open()
+{
+    bool can_grow = canvas_w < growth.max_w || canvas_h < growth.max_h;
+    open = open_setting || can_grow;
+}
+
+template<typename T, typename O, typename R, typename S>
+void basic_rect_packer<T, O, R, S>::edge_clip(
     const free_edge& mask,
     std::vector<free_edge>& clipped
 ){
+    RECT_PACKER_TRACE_EVENT(
+        pack_trace::scope trace_scope(
+            trace, "edge_clip", -1, -1, clipped.size()
+        );
+    )
     for(unsigned i = 0; i < clipped.size(); ++i)
     {
         free_edge* edge = &clipped[i];
 
-        free_edge a, b;
-        if(mask.vertical)
+        // Same as in place_rect(), lengths may be negative here.
+        int ax, ay, a_length, bx, by, b_length;
+        if(mask.vertical())
         {
             if(mask.x != edge->x) continue;
-            a = {
-                edge->x, edge->y, std::min(mask.y - edge->y, edge->length),
-                true, edge->up_right_inside, marker
-            };
-            b = {
-                edge->x, std::max(mask.y + mask.length, edge->y),
-                edge->y + edge->length,
-                true, edge->up_right_inside, marker
-            };
-            b.length -= b.y;
+            ax = edge->x; ay = edge->y;
+            a_length = std::min(mask.y - edge->y, int(edge->length));
+            bx = edge->x; by = std::max(mask.y + mask.length, int(edge->y));
+            b_length = edge->y + edge->length - by;
         }
         else
         {
             if(mask.y != edge->y) continue;
-            a = {
-                edge->x, edge->y, std::min(mask.x - edge->x, edge->length),
-                false, edge->up_right_inside, marker
-            };
-            b = {
-                std::max(mask.x + mask.length, edge->x), edge->y,
-                edge->x + edge->length,
-                false, edge->up_right_inside, marker
-            };
-            b.length -= b.x;
+            ax = edge->x; ay = edge->y;
+            a_length = std::min(mask.x - edge->x, int(edge->length));
+            bx = std::max(mask.x + mask.length, int(edge->x)); by = edge->y;
+            b_length = edge->x + edge->length - bx;
         }
 
-        if(a.length > 0 && b.length > 0)
+        free_edge a = make_edge(
+            ax, ay, a_length, edge->vertical(), edge->up_right_inside()
+        );
+        free_edge b = make_edge(
+            bx, by, b_length, edge->vertical(), edge->up_right_inside()
+        );
+
+        if(a_length > 0 && b_length > 0)
         {
             *edge = a;
             clipped.push_back(b);
         }
-        else if(a.length > 0) *edge = a;
-        else if(b.length > 0) *edge = b;
+        else if(a_length > 0) *edge = a;
+        else if(b_length > 0) *edge = b;
         else {
             clipped.erase(clipped.begin()+i);
             --i;
         }
     }
 }
+
+#define INSTANTIATE_RECT_PACKER(T, open_policy) \
+    template class basic_rect_packer<T, open_policy, runtime_rotation>; \
+    template class basic_rect_packer<T, open_policy, no_rotation>; \
+    template class basic_rect_packer<T, open_policy, always_rotation>;
+
+INSTANTIATE_RECT_PACKER(int, runtime_open)
+INSTANTIATE_RECT_PACKER(int, closed_canvas)
+INSTANTIATE_RECT_PACKER(int, open_canvas)
+INSTANTIATE_RECT_PACKER(std::uint16_t, runtime_open)
+INSTANTIATE_RECT_PACKER(std::uint16_t, closed_canvas)
+INSTANTIATE_RECT_PACKER(std::uint16_t, open_canvas)
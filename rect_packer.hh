@@ -24,6 +24,20 @@ SOFTWARE.
 #ifndef RECT_PACKER_HH
 #define RECT_PACKER_HH
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <cstdint>
+#include <type_traits>
+
+class pack_trace;
+
+// Bumped whenever a change to the algorithm can move any placement, so that
+// stored results (see pack_cache.hh) aren't mistaken for current ones.
+constexpr std::uint32_t rect_packer_algorithm_version = 1;
 
 // This algorithm works by finding such a placing for the rectangle that it's
 // edges are minimally exposed to the area left free. In other words, it
@@ -48,16 +62,131 @@ SOFTWARE.
 //
 // TL;DR; Caveat emptor, this is probably somewhat better but significantly
 // slower than a run-of-the-mill rectangle packer.
-class rect_packer
+
+// Policies for basic_rect_packer. The runtime ones use the value given through
+// set_open() or the allow_rotation parameter, the others fix the setting at
+// compile time so that the search doesn't have to check it at every edge.
+// key() tells the policies apart in get_config_key(), so a policy of your own
+// needs a key that no other policy of the same kind uses.
+struct runtime_open
+{
+    static bool is_open(bool open) { return open; }
+    static std::uint32_t key() { return 0; }
+};
+struct closed_canvas
+{
+    static bool is_open(bool) { return false; }
+    static std::uint32_t key() { return 1; }
+};
+struct open_canvas
+{
+    static bool is_open(bool) { return true; }
+    static std::uint32_t key() { return 2; }
+};
+
+struct runtime_rotation
+{
+    static bool allow(bool allow_rotation) { return allow_rotation; }
+    static std::uint32_t key() { return 0; }
+};
+struct no_rotation
+{
+    static bool allow(bool) { return false; }
+    static std::uint32_t key() { return 1; }
+};
+struct always_rotation
+{
+    static bool allow(bool) { return true; }
+    static std::uint32_t key() { return 2; }
+};
+
+// The scoring policy decides what "minimally exposed" means. edge_score()
+// gets the length of contact between the rect and a free edge, and the sum of
+// those is maximized. ideal_score() is the best possible score of a w*h rect,
+// the search stops early if it's reached.
+struct contact_scoring
+{
+    static int edge_score(int contact) { return contact; }
+    static int ideal_score(int w, int h) { return (w + h) * 2; }
+    static std::uint32_t key() { return 0; }
+};
+
+// Performance counters of a packer, see get_stats(). They are only collected
+// if RECT_PACKER_STATS is defined when compiling rect_packer.cc. Otherwise,
+// everything stays zero and the counting has no cost at all.
+struct rect_packer_stats
+{
+    // Bucket i counts calls that took [2^i, 2^(i+1)) nanoseconds. The last
+    // bucket also counts everything slower than that.
+    struct latency_histogram
+    {
+        static const int bucket_count = 40;
+        std::uint64_t buckets[bucket_count];
+        std::uint64_t calls;
+        std::uint64_t total_ns;
+        std::uint64_t max_ns;
+
+        void add(std::uint64_t ns);
+    };
+
+    // Edges iterated over by the search. Each of them is a line along which
+    // candidate positions are scored.
+    std::uint64_t edges_visited;
+    // Scored candidate positions.
+    std::uint64_t score_rect_calls;
+    // Lookup cells scanned while scoring.
+    std::uint64_t cells_scanned;
+    // Sum of the steps taken along edges between candidates.
+    std::uint64_t skip_distance;
+    // Candidates rejected early because an edge crossed them.
+    std::uint64_t early_exits;
+    // Time spent rebuilding the lookup.
+    std::uint64_t recalc_edge_lookup_ns;
+    // Time spent placing rects, including the lookup rebuild.
+    std::uint64_t place_rect_ns;
+
+    // Latencies of the public functions. The batch pack() calls pack() or
+    // pack_rotate() for each rect, so those get counted too.
+    latency_histogram pack;
+    latency_histogram pack_rotate;
+    latency_histogram pack_batch;
+    latency_histogram enlarge;
+};
+
+// T is the type used to store coordinates internally. The interface always
+// uses int, T only affects the memory layout of the free edges. int works for
+// canvases up to 2^29-1 per side, std::uint16_t halves the size of an edge (8
+// bytes instead of 16) and works for canvases up to 65535x65535. Smaller
+// edges fit better in cache, which speeds up the search on large and
+// fragmented canvases. Larger sizes are clamped to get_max_size() in the
+// constructor, reset(), enlarge() and set_growth().
+//
+// The policies are described above. With the runtime ones, set_open() and
+// allow_rotation work as usual; with the fixed ones, they are ignored.
+//
+// int and std::uint16_t with all combinations of the open and rotation
+// policies above are instantiated in rect_packer.cc. If you write your own
+// policy, add an instantiation for it there. rect_packer is the int version
+// with runtime policies.
+template<
+    typename T,
+    typename open_policy = runtime_open,
+    typename rotation_policy = runtime_rotation,
+    typename scoring_policy = contact_scoring
+>
+class basic_rect_packer
 {
 public:
     // Constructor for rect_packer. w and h determine the size of the packing
     // area. See set_open() for details about open.
-    rect_packer(int w = 0, int h = 0, bool open = false);
+    basic_rect_packer(int w = 0, int h = 0, bool open = false);
 
     // Grows the packing area without clearing already packed rects. w and h
     // represent the new size. Shrinking is not allowed, so if w or h are
-    // smaller than the current width or height, they are clamped.
+    // smaller than the current width or height, they are clamped. An
+    // automatic cell size is kept until the ideal one grows 1.5x larger than
+    // it, so growing in small steps is cheap. A cell size set with
+    // set_cell_size() is always kept.
     void enlarge(int w, int h);
 
     // Clears the packer state, and changes the size of the packing area.
@@ -68,7 +197,14 @@ public:
 
     // -1 for automatic. This only affects the speed of the algorithm, because
     // it adjusts the acceleration structure. The default is almost always good
-    // enough.
+    // enough. The cells are allocated only where there are free edges, so
+    // even very large canvases (65536x65536 and up) don't need much memory.
+    // Any cell size, even a set one, is raised as needed to keep the lookup
+    // within about 4096 cells per side.
+    // The automatic size comes from the table in cell_size_table.hh, by the
+    // canvas area and get_mean_rect_size(). The batch pack() and batch_job
+    // also switch to it if the batch changes it more than 1.5x. Regenerate
+    // the table with patm-autotune to tune for your hardware and workload.
     void set_cell_size(int cell_size = -1);
 
     // If open, cost approximation is adjusted such that packing after enlarge()
@@ -77,6 +213,65 @@ public:
     // worse.
     void set_open(bool open);
 
+    // By default, the search slides each rect along every free edge. The
+    // corner search only tries the positions where the rect lines up with an
+    // end of a free edge. The skips already make the full search stop at few
+    // positions per edge, so this is only somewhat faster, and it may pack a
+    // little worse. With refine > 0, the 'refine' edges with the best corner
+    // scores are then searched fully as well.
+    void set_corner_search(bool corner, int refine = 0);
+
+    // Speeds up batches with many rects of the same size, like sprite frames
+    // or fixed-size glyph cells. The batch pack() and batch_job then also
+    // sort by the shorter side, so equal sizes end up next to each other.
+    // Runs of at least min_block_run equal rects are placed as grid blocks,
+    // one search per block instead of one per rect. Blocks that don't fit
+    // are split in half until they do; what's left is packed one by one.
+    void set_block_runs(bool block_runs);
+    static const int min_block_run = 4;
+
+    // Lets pack() enlarge the canvas by itself instead of failing.
+    struct growth_policy
+    {
+        // The canvas never grows past these, so by default it doesn't grow.
+        int max_w = 0, max_h = 0;
+
+        // If true, grown sizes are rounded up to powers of two. Otherwise,
+        // they're grown by multiples of step.
+        bool power_of_two = true;
+        int step = 1;
+
+        // Preferred width/height ratio. Of the possible ways to grow, the one
+        // closest to this ratio is picked, then the smallest one. Must be
+        // positive, anything else is taken as 1.
+        float aspect = 1.0f;
+    };
+
+    // When a rect doesn't fit, the canvas is grown just enough along one side
+    // that it is guaranteed to fit, counting the free space already at that
+    // side, so there's only one failed search per growth. The packer is
+    // treated as open while it can still grow, as if set_open(true) had been
+    // called.
+    void set_growth(const growth_policy& policy);
+
+    // The current canvas size, which changes when the packer grows.
+    int get_width() const;
+    int get_height() const;
+
+    // The largest canvas side. Rects with a larger side never fit. For int,
+    // it's 2^29-1 so that the perimeter of a rect, the highest score, fits in
+    // an int.
+    static int get_max_size();
+
+    // Appends everything besides the rects themselves that decides where
+    // they get placed: the algorithm version, policies, canvas size, open,
+    // growth policy, search mode, block runs and cell size, including what
+    // the automatic cell size depends on. The free edges are not included,
+    // so this only describes a packer that hasn't packed anything since
+    // construction or reset(). Used as the key of stored results, see
+    // pack_cache.hh.
+    void get_config_key(std::vector<std::uint32_t>& key) const;
+
     // Returns false if this rectangle could not be packed. In that case, use
     // enlarge() to make the canvas larger and retry. If succesful, the
     // coordinates of the corner closest to your origin are written to x and y.
@@ -85,7 +280,7 @@ public:
     bool pack(int w, int h, int& x, int& y);
 
     // pack(), but allows 90 degree rotation of the input rectangle. rotated is
-    // set to true if that happened.
+    // set to true if that happened. With no_rotation, this is just pack().
     bool pack_rotate(int w, int h, int& x, int& y, bool& rotated);
 
     struct rect
@@ -110,19 +305,248 @@ public:
     // packed, it is not packed again but does count towards the return value.
     int pack(rect* rects, size_t count, bool allow_rotation = false);
 
+    // The batch pack() above, but run a little at a time, e.g. for a few
+    // milliseconds per frame. The rects are sorted once on construction, and
+    // each step() packs them in that order until its time budget runs out.
+    // The rects and the packer must outlive the job, and the packer must not
+    // be used for anything else until the job is done.
+    class batch_job
+    {
+    public:
+        // If cancel is given and becomes true, the job stops at the next
+        // rect, leaving the rest unpacked. It can be set from any thread.
+        batch_job(
+            basic_rect_packer& packer, rect* rects, size_t count,
+            bool allow_rotation = false,
+            const std::atomic<bool>* cancel = nullptr
+        );
+
+        // Packs rects until time_budget is used up, always at least one.
+        // Returns true once the job is done or cancelled.
+        bool step(std::chrono::nanoseconds time_budget);
+
+        bool done() const;
+        bool cancelled() const;
+
+        // Rects handled so far, including the ones that didn't fit, out of
+        // get_count().
+        size_t get_progress() const;
+        size_t get_count() const;
+
+        // Number of packed rects so far, like the return value of pack().
+        int get_packed() const;
+
+    private:
+        basic_rect_packer* packer;
+        std::vector<rect*> order;
+        size_t next;
+        int packed;
+        bool allow_rotation;
+        const std::atomic<bool>* cancel;
+        bool was_cancelled;
+    };
+
+    // Marks already known placements as occupied, e.g. to restore an earlier
+    // atlas or to reserve regions. x, y, w, h and rotated are read from each
+    // rect. Returns false and changes nothing if any of them are out of
+    // bounds, overlap each other or overlap previously packed rects. The free
+    // edges are rebuilt with one sweep for the whole batch, so this is much
+    // faster than packing them one by one.
+    bool place_fixed(const rect* rects, size_t count);
+
+    // Packs a changed version of an earlier layout, clearing the packer
+    // first. prev is the earlier layout as pack() left it, rects the new set.
+    // They're matched by index, so keep the order and add new rects at the
+    // end; a removed rect can be replaced by the last one, which then just
+    // gets packed again. Rects with the same size as before keep their
+    // placement and are restored with place_fixed(), only the new and
+    // resized ones are packed, so the cost follows the size of the change.
+    // If some of those don't fit, everything is repacked from scratch, and
+    // whichever layout packs more rects is kept. Returns the number of
+    // packed rects, like the batch pack().
+    int repack(
+        const rect* prev, size_t prev_count, rect* rects, size_t count,
+        bool allow_rotation = false
+    );
+
+    // True if the area is within the canvas and nothing has been packed there.
+    bool is_free(int x, int y, int w, int h) const;
+
+    // Returns the counters collected since construction or the last
+    // reset_stats(). Only available with RECT_PACKER_STATS, see
+    // rect_packer_stats.
+    const rect_packer_stats& get_stats() const;
+    void reset_stats();
+
+    // Records the phases of packing (sorting, searching, placing, clipping,
+    // lookup updates, enlarging) into the given trace, see pack_trace.hh.
+    // nullptr disables tracing. Only available with RECT_PACKER_TRACE.
+    void set_trace(pack_trace* trace);
+
+    // Read-only view of the search structures, for visualization and
+    // debugging. Free edges are what rects get slid along, and the cells are
+    // the grid that find edges near a rect.
+    struct edge_info
+    {
+        int x, y, length;
+        bool vertical;
+        bool up_right_inside;
+    };
+    size_t get_edge_count() const;
+    edge_info get_edge(size_t index) const;
+
+    int get_lookup_cell_size() const;
+
+    // The mean (w+h)/2 of the rects given to pack() and pack_rotate() so far,
+    // or 0 before any. Picks the automatic cell size. It's kept over reset(),
+    // since it describes the workload rather than the current layout.
+    double get_mean_rect_size() const;
+    int get_lookup_width() const;
+    int get_lookup_height() const;
+
+    // Number of edges referenced by the cell.
+    size_t get_cell_edge_count(int cx, int cy) const;
+
+    // When enabled, counts how many times scoring scans each cell. This costs
+    // a little speed. The counts are cleared when enabled and whenever the
+    // cell size changes, which includes reset() and some enlarge() calls.
+    void set_count_visits(bool count);
+    std::uint32_t get_cell_visits(int cx, int cy) const;
+
 private:
+    typedef typename std::make_unsigned<T>::type flag_type;
+    typedef std::uint32_t edge_index;
+
+    // The two lowest bits of 'bits' are the 'vertical' and 'up_right_inside'
+    // flags, the rest is the marker used to avoid scoring the same edge twice.
     struct free_edge
     {
-        int x, y, length;
-        bool vertical, up_right_inside;
-        unsigned marker;
+        T x, y, length;
+        flag_type bits;
+
+        bool vertical() const { return bits & 1; }
+        bool up_right_inside() const { return bits & 2; }
+        flag_type marker() const { return bits >> 2; }
+        void set_marker(flag_type m)
+        {
+            bits = flag_type((bits & 3) | (m << 2));
+        }
     };
 
+    static const flag_type max_marker = flag_type(~flag_type(0)) >> 2;
+
+    // The order in which the batch pack() and batch_job handle rects.
+    void sort_batch(
+        rect* rects, size_t count, std::vector<rect*>& order
+    ) const;
+    void sort_order(std::vector<rect*>& order) const;
+    // Packs the next rect of a sorted batch, or with block runs, the whole
+    // run of equal rects starting from it. Returns the index after them and
+    // adds the packed ones to 'packed'.
+    size_t pack_batch_step(
+        const std::vector<rect*>& order, size_t next, bool allow_rotation,
+        int& packed
+    );
+    // Switches an automatic cell size to suit a batch that is about to be
+    // packed, see set_cell_size().
+    void tune_cell_size(const rect* rects, size_t count);
+    void track_rect_size(int w, int h, std::uint64_t count = 1);
+    // Packs one rect of a batch, returns true if it is packed.
+    bool pack_batch_rect(rect& r, bool allow_rotation);
+    // Places as many of the equal rects as possible in grid blocks, returns
+    // how many were placed. The rest are left for pack_batch_rect().
+    size_t pack_block_run(rect* const* run, size_t count, bool allow_rotation);
+
+    free_edge make_edge(
+        int x, int y, int length, bool vertical, bool up_right_inside
+    ) const;
+
+    // Advances the marker, clearing the markers of all edges if it would wrap
+    // around. With small T, this can happen within a single search.
+    void next_marker();
+
     void recalc_edge_lookup();
 
+    // The lookup cells are stored sparsely, in pages of page_size*page_size
+    // cells. A page is only allocated once an edge (or, when counting, a
+    // visit) lands in it, so memory follows the number of edges instead of
+    // the canvas area. Each page also holds the visit counts of its cells.
+    static const int page_shift = 4;
+    static const int page_size = 1 << page_shift;
+    struct cell_page
+    {
+        std::vector<edge_index> cells[page_size * page_size];
+        std::uint32_t visits[page_size * page_size] = {};
+    };
+    // The pages are found through a dense grid of blocks, each holding the
+    // pointers of page_size*page_size pages. Blocks are also only allocated
+    // with their first page, so an empty canvas needs only a few of them.
+    struct page_block
+    {
+        std::unique_ptr<cell_page> pages[page_size * page_size];
+    };
+
+    // The largest lookup width and height the cell size is picked for. This
+    // bounds the size of the block grid and the number of pages a border
+    // edge is rasterized into.
+    static const int max_lookup_size = 1 << 12;
+    // The smallest cell size that keeps a w*h canvas within max_lookup_size.
+    static int min_cell_size(int w, int h);
+
+    // Returns null if the cell's page hasn't been allocated.
+    cell_page* find_page(int cx, int cy) const;
+    // Allocates the page if needed.
+    cell_page& get_page(int cx, int cy);
+    static int cell_in_page(int cx, int cy);
+
+    // Sets the lookup size from the canvas and cell size. If keep is true,
+    // the pages are moved to match the new size, otherwise they're freed and
+    // the cell size is raised to min_cell_size() if needed.
+    void resize_lookup(bool keep);
+
+    // Calls f with every allocated page.
+    template<typename F>
+    void for_each_page(F&& f);
+
+    // Calls f with the coordinates of every lookup cell the edge belongs to.
+    template<typename F>
+    void for_each_edge_cell(const free_edge& edge, F&& f);
+
+    // Add or remove a single edge from the lookup cells.
+    void link_edge(edge_index index);
+    void unlink_edge(edge_index index);
+
+    // Merges free edges on the given lines that touch end to end and face the
+    // same way, keeping the lowest index of each merged run. If linked, the
+    // lookup is kept up to date, otherwise the order of the edges is kept.
+    void coalesce_edges(
+        std::initializer_list<int> vertical_lines,
+        std::initializer_list<int> horizontal_lines,
+        bool linked
+    );
+
+    // Removes an edge by moving the last edge in its place. If linked, the
+    // lookup is kept up to date, and the removed edge must already be
+    // unlinked.
+    void remove_edge(edge_index index, bool linked);
+
     int find_max_score(
         int w, int h, int& x, int& y,
-        std::vector<free_edge*>& affected_edges
+        std::vector<edge_index>& affected_edges
+    );
+
+    // The corner search, see set_corner_search().
+    int find_corner_score(
+        int w, int h, int& x, int& y,
+        std::vector<edge_index>& affected_edges
+    );
+
+    // Slides the rect along one edge, updating the best score and position
+    // if a better one is found.
+    void search_edge(
+        const free_edge& edge, int w, int h,
+        int& best_score, int& best_x, int& best_y,
+        std::vector<edge_index>& best_affected_edges
     );
 
     // 0 if can't be placed here. Otherwise, number of blocked edges.
@@ -132,30 +556,56 @@ private:
     // better. 'end' is the end x or y coordinate in the currently tracked edge.
     int score_rect(
         int x, int y, int w, int h, int& skip, int end,
-        std::vector<free_edge*>& affected_edges
+        std::vector<edge_index>& affected_edges
     );
 
-    int score_rect_edge(int x, int y, int w, int h, free_edge* edge);
+    int score_rect_edge(
+        int x, int y, int w, int h, const free_edge& edge
+    ) const;
 
     void place_rect(
         int x, int y, int w, int h,
-        std::vector<free_edge*>& affected_edges
+        std::vector<edge_index>& affected_edges
     );
 
     void edge_clip(const free_edge& mask, std::vector<free_edge>& clipped);
 
+    // Enlarges the canvas so that a w*h rect (or h*w, with rotation) is sure
+    // to fit. Returns false if the growth policy doesn't allow that.
+    bool grow_to_fit(int w, int h, bool allow_rotation);
+    void update_open();
+
+    // Cells refer to edges by index instead of pointer, halving their size.
     std::vector<free_edge> edges;
     int canvas_w, canvas_h;
-    std::vector<
-        std::vector<free_edge*>
-    > edge_lookup;
+    std::vector<std::unique_ptr<page_block>> page_blocks;
     int lookup_w, lookup_h;
+    int blocks_w, blocks_h;
     int cell_size;
+    bool fixed_cell_size;
+    // Sum of w+h and the number of rects, for get_mean_rect_size().
+    std::uint64_t rect_size_sum;
+    std::uint64_t rect_size_count;
+    // 'open' is what scoring uses, 'open_setting' is what set_open() gave.
     bool open;
-    unsigned marker;
+    bool open_setting;
+    growth_policy growth;
+    bool corner_search;
+    int refine_edges;
+    bool block_runs;
+    flag_type marker;
 
     // Stored here to avoid allocations.
-    std::vector<free_edge*> tmp;
+    std::vector<edge_index> tmp;
+    std::vector<std::pair<int, edge_index>> corner_scores;
+
+    bool count_visits;
+
+    rect_packer_stats stats;
+    pack_trace* trace;
 };
 
+typedef basic_rect_packer<int> rect_packer;
+typedef basic_rect_packer<std::uint16_t> compact_rect_packer;
+
 #endif
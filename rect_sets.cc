@@ -0,0 +1,119 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "rect_sets.hh"
+#include <algorithm>
+#include <cmath>
+
+std::vector<rect_packer::rect> generate_guillotine_set(
+    int w, int h, unsigned splits, unsigned seed
+){
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<> bdis(0,1);
+
+    struct node
+    {
+        int w, h;
+        bool vertical;
+        std::vector<node> children;
+
+        bool atomic()
+        {
+            return (vertical && w == 1) || (!vertical && h == 1);
+        }
+
+        bool split(std::mt19937& rng)
+        {
+            if(atomic()) return false;
+            if(children.size())
+            {
+                std::uniform_int_distribution<> bdis(0,1);
+                int first = bdis(rng);
+                int second = first^1;
+                return children[first].split(rng) || children[second].split(rng);
+            }
+
+            if(vertical)
+            {
+                std::uniform_int_distribution<> wdis(1,w-1);
+                int split = wdis(rng);
+                children.push_back({split, h, false,{}});
+                children.push_back({w-split, h, false,{}});
+            }
+            else
+            {
+                std::uniform_int_distribution<> hdis(1,h-1);
+                int split = hdis(rng);
+                children.push_back({w, split, true,{}});
+                children.push_back({w, h-split, true,{}});
+            }
+            return true;
+        }
+
+        void traverse(int x, int y, std::vector<rect_packer::rect>& rects)
+        {
+            if(children.empty())
+            {
+                rect_packer::rect r;
+                r.w = w;
+                r.h = h;
+                r.x = x;
+                r.y = y;
+                rects.push_back(r);
+            }
+            else for(node& child: children)
+            {
+                child.traverse(x, y, rects);
+                if(vertical) x += child.w;
+                else y += child.h;
+            }
+        }
+    };
+    node root{w, h, bdis(rng) == 1, {}};
+    for(unsigned i = 0; i < splits; ++i) root.split(rng);
+    std::vector<rect_packer::rect> rects;
+    root.traverse(0, 0, rects);
+    std::shuffle(rects.begin(), rects.end(), rng);
+    return rects;
+}
+
+glyph_generator::glyph_generator(const glyph_distribution& dist, unsigned seed)
+:   rng(seed),
+    w_dist(dist.w_mean, dist.w_stddev),
+    h_dist(dist.h_mean, dist.h_stddev),
+    g_dist(dist.g_mean, dist.g_stddev)
+{
+}
+
+std::vector<rect_packer::rect> glyph_generator::next_group()
+{
+    std::vector<rect_packer::rect> rects;
+    int group_size = round(g_dist(rng));
+    for(int i = 0; i < group_size; ++i)
+    {
+        int w = std::max((int)round(w_dist(rng)), 1);
+        int h = std::max((int)round(h_dist(rng)), 1);
+        rects.push_back({w, h});
+    }
+    return rects;
+}
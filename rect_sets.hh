@@ -0,0 +1,63 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_RECT_SETS_HH
+#define RECT_PACKER_RECT_SETS_HH
+#include "rect_packer.hh"
+#include <random>
+#include <vector>
+
+// Test inputs shared by the visualizer and the headless tools. Everything is
+// seeded explicitly, so the same seed always gives the same set.
+
+// Recursively splits a w*h area into 'splits' + 1 rects, so the whole set fits
+// perfectly. The x and y of each rect are set to its position in the original
+// area. The set is shuffled with the same seed.
+std::vector<rect_packer::rect> generate_guillotine_set(
+    int w, int h, unsigned splits, unsigned seed
+);
+
+// Mimics font glyphs: sizes and group sizes are drawn from normal
+// distributions.
+struct glyph_distribution
+{
+    float w_mean, w_stddev;
+    float h_mean, h_stddev;
+    float g_mean, g_stddev;
+};
+
+class glyph_generator
+{
+public:
+    glyph_generator(const glyph_distribution& dist, unsigned seed);
+
+    // Draws the next group of glyphs. The group is empty if the drawn group
+    // size is not positive.
+    std::vector<rect_packer::rect> next_group();
+
+private:
+    std::mt19937 rng;
+    std::normal_distribution<float> w_dist, h_dist, g_dist;
+};
+
+#endif
@@ -0,0 +1,387 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "sharded_packer.hh"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+
+sharded_rect_packer::shard::shard(int x, int y, int w, int h)
+: packer(w, h, false), x(x), y(y), w(w), h(h),
+  fail_hint(std::numeric_limits<std::uint64_t>::max())
+{
+}
+
+// If a rect didn't fit, a rect that's at least as large in both directions
+// won't fit either.
+bool sharded_rect_packer::shard::may_fit(
+    int w, int h, bool allow_rotation
+) const {
+    std::uint64_t hint = fail_hint.load(std::memory_order_relaxed);
+    std::uint32_t fail_w = hint, fail_h = hint >> 32;
+    auto fits = [&](int w, int h){
+        return w <= this->w && h <= this->h &&
+            (std::uint32_t(w) < fail_w || std::uint32_t(h) < fail_h);
+    };
+    return fits(w, h) || (allow_rotation && fits(h, w));
+}
+
+void sharded_rect_packer::shard::add_failure(int w, int h)
+{
+    std::uint64_t hint = fail_hint.load(std::memory_order_relaxed);
+    std::uint64_t fail_w = hint & 0xFFFFFFFF, fail_h = hint >> 32;
+    if(std::uint64_t(w) * h < fail_w * fail_h)
+    {
+        fail_hint.store(
+            std::uint64_t(w) | std::uint64_t(h) << 32,
+            std::memory_order_relaxed
+        );
+    }
+}
+
+sharded_rect_packer::sharded_rect_packer(
+    int w, int h, int shards_x, int shards_y
+): canvas_w(w), canvas_h(h),
+   shards_x(std::max(std::min(shards_x, w), 1)),
+   shards_y(std::max(std::min(shards_y, h), 1)),
+   cross_shard_count(0)
+{
+    for(int j = 0; j < this->shards_y; ++j)
+    {
+        int y0 = h * j / this->shards_y;
+        int y1 = h * (j + 1) / this->shards_y;
+        for(int i = 0; i < this->shards_x; ++i)
+        {
+            int x0 = w * i / this->shards_x;
+            int x1 = w * (i + 1) / this->shards_x;
+            shards.emplace_back(new shard(x0, y0, x1 - x0, y1 - y0));
+        }
+    }
+}
+
+bool sharded_rect_packer::pack(int w, int h, int& x, int& y)
+{
+    bool rotated = false;
+    return pack_any(w, h, x, y, rotated, false);
+}
+
+bool sharded_rect_packer::pack_rotate(
+    int w, int h, int& x, int& y, bool& rotated
+){
+    return pack_any(w, h, x, y, rotated, true);
+}
+
+int sharded_rect_packer::pack(
+    rect_packer::rect* rects, size_t count, bool allow_rotation,
+    unsigned threads
+){
+    std::vector<rect_packer::rect*> order;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(rects[i].packed) continue;
+        rects[i].rotated = false;
+        order.push_back(rects + i);
+    }
+    std::sort(
+        order.begin(), order.end(),
+        [](const rect_packer::rect* a, const rect_packer::rect* b){
+            return std::max(a->w, a->h) > std::max(b->w, b->h);
+        }
+    );
+
+    auto fits_shard = [&](const shard& s, int w, int h){
+        return (w <= s.w && h <= s.h) ||
+            (allow_rotation && h <= s.w && w <= s.h);
+    };
+
+    // Spilled rects go first, while there's still room across the borders.
+    // The rest are routed so that the shards fill up evenly.
+    std::vector<std::vector<rect_packer::rect>> routed(shards.size());
+    std::vector<std::vector<rect_packer::rect*>> sources(shards.size());
+    std::vector<std::uint64_t> load(shards.size(), 0);
+    {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for(std::unique_ptr<shard>& s: shards) locks.emplace_back(s->mutex);
+
+        for(rect_packer::rect* r: order)
+        {
+            size_t best = shards.size();
+            for(size_t i = 0; i < shards.size(); ++i)
+            {
+                if(!fits_shard(*shards[i], r->w, r->h)) continue;
+                if(best == shards.size() || load[i] < load[best]) best = i;
+            }
+
+            if(best == shards.size())
+            {
+                if(r->w > 0 && r->h > 0)
+                {
+                    r->packed = pack_across(
+                        r->w, r->h, r->x, r->y, r->rotated, allow_rotation
+                    );
+                }
+                if(r->packed) cross_shard_count++;
+                continue;
+            }
+            load[best] += std::uint64_t(r->w) * r->h;
+            routed[best].push_back(*r);
+            sources[best].push_back(r);
+        }
+    }
+
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    threads = std::max(std::min(threads, unsigned(shards.size())), 1u);
+
+    std::atomic<size_t> next_shard(0);
+    auto worker = [&](){
+        for(;;)
+        {
+            size_t index = next_shard++;
+            if(index >= shards.size()) break;
+
+            shard& s = *shards[index];
+            std::vector<rect_packer::rect>& batch = routed[index];
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.packer.pack(batch.data(), batch.size(), allow_rotation);
+            for(rect_packer::rect& r: batch)
+            {
+                if(!r.packed) s.add_failure(r.w, r.h);
+                else
+                {
+                    r.x += s.x;
+                    r.y += s.y;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < threads; ++i) pool.emplace_back(worker);
+    worker();
+    for(std::thread& t: pool) t.join();
+
+    // The leftovers are retried in sorted order, any shard may have room.
+    std::vector<rect_packer::rect*> leftovers;
+    for(size_t i = 0; i < shards.size(); ++i)
+    for(size_t j = 0; j < routed[i].size(); ++j)
+    {
+        rect_packer::rect* r = sources[i][j];
+        *r = routed[i][j];
+        if(!r->packed) leftovers.push_back(r);
+    }
+    std::stable_sort(
+        leftovers.begin(), leftovers.end(),
+        [](const rect_packer::rect* a, const rect_packer::rect* b){
+            return std::max(a->w, a->h) > std::max(b->w, b->h);
+        }
+    );
+    for(rect_packer::rect* r: leftovers)
+    {
+        r->packed = pack_any(
+            r->w, r->h, r->x, r->y, r->rotated, allow_rotation
+        );
+    }
+
+    int packed = 0;
+    for(size_t i = 0; i < count; ++i)
+        if(rects[i].packed) packed++;
+    return packed;
+}
+
+int sharded_rect_packer::get_width() const { return canvas_w; }
+int sharded_rect_packer::get_height() const { return canvas_h; }
+
+int sharded_rect_packer::get_shards_x() const { return shards_x; }
+int sharded_rect_packer::get_shards_y() const { return shards_y; }
+
+std::uint64_t sharded_rect_packer::get_cross_shard_count() const
+{
+    return cross_shard_count.load();
+}
+
+bool sharded_rect_packer::pack_any(
+    int w, int h, int& x, int& y, bool& rotated, bool allow_rotation
+){
+    rotated = false;
+    if(w <= 0 || h <= 0) return false;
+
+    // Threads start from different shards, so that they don't all compete
+    // for the first one.
+    size_t count = shards.size();
+    size_t home = std::hash<std::thread::id>()(std::this_thread::get_id());
+    thread_local std::vector<size_t> busy;
+    busy.clear();
+
+    // Busy shards are skipped at first, and only waited for if none of the
+    // free ones had space.
+    for(size_t i = 0; i < count; ++i)
+    {
+        size_t index = (home + i) % count;
+        shard& s = *shards[index];
+        if(!s.may_fit(w, h, allow_rotation)) continue;
+
+        std::unique_lock<std::mutex> lock(s.mutex, std::try_to_lock);
+        if(!lock.owns_lock()) busy.push_back(index);
+        else if(pack_in_shard(s, w, h, x, y, rotated, allow_rotation))
+            return true;
+    }
+
+    for(size_t index: busy)
+    {
+        shard& s = *shards[index];
+        if(!s.may_fit(w, h, allow_rotation)) continue;
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if(pack_in_shard(s, w, h, x, y, rotated, allow_rotation))
+            return true;
+    }
+
+    // Always locked in the same order, and the fast path never holds more
+    // than one lock, so this can't deadlock.
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(count);
+    for(std::unique_ptr<shard>& s: shards) locks.emplace_back(s->mutex);
+
+    if(!pack_across(w, h, x, y, rotated, allow_rotation)) return false;
+    cross_shard_count++;
+    return true;
+}
+
+bool sharded_rect_packer::pack_in_shard(
+    shard& s, int w, int h, int& x, int& y, bool& rotated,
+    bool allow_rotation
+){
+    bool packed = allow_rotation ?
+        s.packer.pack_rotate(w, h, x, y, rotated) :
+        s.packer.pack(w, h, x, y);
+    if(!packed)
+    {
+        s.add_failure(w, h);
+        return false;
+    }
+    x += s.x;
+    y += s.y;
+    return true;
+}
+
+// Free space that crosses shard borders is bounded by free edges of the
+// shards on both sides, so the rect is tried at every end of every free edge
+// and the lowest, then leftmost spot is taken.
+bool sharded_rect_packer::pack_across(
+    int w, int h, int& x, int& y, bool& rotated, bool allow_rotation
+){
+    bool found = false;
+    int best_x = 0, best_y = 0;
+    bool best_rotated = false;
+
+    auto try_at = [&](int cx, int cy, int w, int h, bool rot){
+        if(found && (cy > best_y || (cy == best_y && cx >= best_x)))
+            return;
+        if(!fits_across(cx, cy, w, h)) return;
+        found = true;
+        best_x = cx;
+        best_y = cy;
+        best_rotated = rot;
+    };
+
+    for(const std::unique_ptr<shard>& s: shards)
+    {
+        for(size_t i = 0; i < s->packer.get_edge_count(); ++i)
+        {
+            rect_packer::edge_info e = s->packer.get_edge(i);
+            int ends[2][2] = {
+                {s->x + e.x, s->y + e.y},
+                {
+                    s->x + e.x + (e.vertical ? 0 : e.length),
+                    s->y + e.y + (e.vertical ? e.length : 0)
+                }
+            };
+            for(int j = 0; j < 4; ++j)
+            {
+                int px = ends[j / 2][0], py = ends[j / 2][1];
+                bool left = j & 1;
+                for(int r = 0; r < (allow_rotation && w != h ? 2 : 1); ++r)
+                {
+                    int rw = r ? h : w, rh = r ? w : h;
+                    try_at(left ? px - rw : px, py, rw, rh, r);
+                    try_at(left ? px - rw : px, py - rh, rw, rh, r);
+                }
+            }
+        }
+    }
+    if(!found) return false;
+
+    x = best_x;
+    y = best_y;
+    rotated = best_rotated;
+    if(rotated) place_across(x, y, h, w);
+    else place_across(x, y, w, h);
+    return true;
+}
+
+// Only spots that actually cross a border count, the shards have already
+// been searched on their own.
+bool sharded_rect_packer::fits_across(int x, int y, int w, int h) const
+{
+    if(x < 0 || y < 0 || x + w > canvas_w || y + h > canvas_h) return false;
+
+    int overlapping = 0;
+    for(const std::unique_ptr<shard>& s: shards)
+    {
+        if(
+            x < s->x + s->w && x + w > s->x &&
+            y < s->y + s->h && y + h > s->y
+        ) overlapping++;
+    }
+    if(overlapping < 2) return false;
+
+    for(const std::unique_ptr<shard>& s: shards)
+    {
+        int x0 = std::max(x, s->x), x1 = std::min(x + w, s->x + s->w);
+        int y0 = std::max(y, s->y), y1 = std::min(y + h, s->y + s->h);
+        if(x0 >= x1 || y0 >= y1) continue;
+        if(!s->packer.is_free(x0 - s->x, y0 - s->y, x1 - x0, y1 - y0))
+            return false;
+    }
+    return true;
+}
+
+// Each shard gets the piece of the rect that's inside it.
+void sharded_rect_packer::place_across(int x, int y, int w, int h)
+{
+    for(std::unique_ptr<shard>& s: shards)
+    {
+        int x0 = std::max(x, s->x), x1 = std::min(x + w, s->x + s->w);
+        int y0 = std::max(y, s->y), y1 = std::min(y + h, s->y + s->h);
+        if(x0 >= x1 || y0 >= y1) continue;
+
+        rect_packer::rect piece;
+        piece.w = x1 - x0;
+        piece.h = y1 - y0;
+        piece.x = x0 - s->x;
+        piece.y = y0 - s->y;
+        piece.packed = true;
+        s->packer.place_fixed(&piece, 1);
+    }
+}
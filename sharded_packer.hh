@@ -0,0 +1,120 @@
+/*
+MIT License
+
+Copyright (c) 2019 Julius Ikkala
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RECT_PACKER_SHARDED_PACKER_HH
+#define RECT_PACKER_SHARDED_PACKER_HH
+#include "rect_packer.hh"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A packer that many threads can pack into at the same time. The canvas is
+// split into a grid of shards, each with its own rect_packer and lock, so
+// packs that land in different shards don't wait for each other. Each thread
+// starts from its own shard and moves on to the next ones if the shard is
+// busy or full.
+//
+// Rects that don't fit in any single shard take a slower path that locks all
+// shards and looks for a spot that straddles their borders. A shard remembers
+// the smallest rect it has failed to fit, and larger rects skip it.
+//
+// There's also a tiled batch mode, where each shard packs its share of a
+// batch on its own thread. Since each shard only has the edges of its own
+// area, the time per rect stays flat as the canvas grows, instead of growing
+// with the whole canvas like in rect_packer.
+//
+// All placements are in the coordinates of the whole canvas. Fewer, larger
+// shards pack a little tighter, since the shard borders split up the free
+// space.
+class sharded_rect_packer
+{
+public:
+    sharded_rect_packer(int w, int h, int shards_x, int shards_y);
+
+    // Like rect_packer::pack() and rect_packer::pack_rotate(). These can be
+    // called from any number of threads at once.
+    bool pack(int w, int h, int& x, int& y);
+    bool pack_rotate(int w, int h, int& x, int& y, bool& rotated);
+
+    // Packs a batch with the shards in parallel, on up to 'threads' threads
+    // (0 for one per hardware thread). Rects that are too large for any
+    // shard are placed across shards first. The rest are sorted like in
+    // rect_packer's batch pack(), routed to the shards that have the least
+    // area assigned so far and packed with a batch pack() per shard. Rects
+    // that didn't fit their shard are retried with pack() afterwards. The
+    // return value and the rect fields work like in rect_packer.
+    int pack(
+        rect_packer::rect* rects, size_t count, bool allow_rotation = false,
+        unsigned threads = 0
+    );
+
+    int get_width() const;
+    int get_height() const;
+
+    int get_shards_x() const;
+    int get_shards_y() const;
+
+    // Number of rects that had to be packed across shard borders.
+    std::uint64_t get_cross_shard_count() const;
+
+private:
+    struct shard
+    {
+        shard(int x, int y, int w, int h);
+
+        std::mutex mutex;
+        rect_packer packer;
+        int x, y, w, h;
+        // Width and height of the smallest rect that didn't fit, in the low
+        // and high 32 bits. Written with the lock held, read without it.
+        std::atomic<std::uint64_t> fail_hint;
+
+        bool may_fit(int w, int h, bool allow_rotation) const;
+        void add_failure(int w, int h);
+    };
+
+    bool pack_any(
+        int w, int h, int& x, int& y, bool& rotated, bool allow_rotation
+    );
+    bool pack_in_shard(
+        shard& s, int w, int h, int& x, int& y, bool& rotated,
+        bool allow_rotation
+    );
+
+    // The slow path, all shards must be locked.
+    bool pack_across(
+        int w, int h, int& x, int& y, bool& rotated, bool allow_rotation
+    );
+    bool fits_across(int x, int y, int w, int h) const;
+    void place_across(int x, int y, int w, int h);
+
+    int canvas_w, canvas_h;
+    int shards_x, shards_y;
+    // shard isn't movable because of the mutex.
+    std::vector<std::unique_ptr<shard>> shards;
+    std::atomic<std::uint64_t> cross_shard_count;
+};
+
+#endif